@@ -0,0 +1,393 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "compact.h"
+#include "simulation.h"
+#include "swarm.h"
+#include "sweep.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+// Headless benchmark of the step engines over a sweep of particle counts and
+// densities. Every engine is a BenchCase; to add one, give it a name and a
+// factory in benchEngines() below.
+
+
+// One engine under test, advanced a step at a time
+class BenchCase {
+public:
+    virtual ~BenchCase() {}
+    virtual void step() = 0;
+};
+
+
+// Any configuration of Simulation
+class SimulationCase : public BenchCase {
+public:
+    SimulationCase(const Params& params): sim(params) {}
+    void step() override {
+        sim.step();
+    }
+
+private:
+    Simulation sim;
+};
+
+
+// The 16-bit quantized engine
+class CompactCase : public BenchCase {
+public:
+    CompactCase(const Params& params): sim(params) {}
+    void step() override {
+        sim.step();
+    }
+
+private:
+    CompactSimulation sim;
+};
+
+
+// The 3D engine of --dimensions 3. The box is a cube holding as many
+// neighbours per particle as the 2D box: density * pi r^2 = rho * 4/3 pi r^3.
+class SwarmCase : public BenchCase {
+public:
+    SwarmCase(const Params& params): sim(cube(params)) {}
+    void step() override {
+        sim.step();
+    }
+
+private:
+    Swarm<3> sim;
+
+    static Params cube(Params params) {
+        float density = params.nParticles / (params.width * params.height);
+        float volumeDensity = density * 3 / (4 * params.interactionRadius);
+        params.width = params.height = params.depth = std::cbrt(params.nParticles / volumeDensity);
+        return params;
+    }
+};
+
+
+// The array-of-structs engine of old_main.cpp: one Particle object per
+// particle, padding copies for the periodic boundary and an O(N^2) serial
+// search. Only the noise source is swapped for the counter-based one.
+class AosCase : public BenchCase {
+public:
+    struct Particle {
+        float pos[2];
+        float vel[2];
+        float currentAngle;
+    };
+
+    AosCase(const Params& params_): params(params_) {
+        std::mt19937 generator(params.seed);
+        std::uniform_real_distribution<float> xRand(0, params.width);
+        std::uniform_real_distribution<float> yRand(0, params.height);
+        std::uniform_real_distribution<float> thetaRand(0, 3.14159*2);
+        swarm.resize(params.nParticles);
+        for (Particle& p : swarm) {
+            p.pos[0] = xRand(generator);
+            p.pos[1] = yRand(generator);
+            p.currentAngle = thetaRand(generator);
+            p.vel[0] = params.velocity*std::cos(p.currentAngle);
+            p.vel[1] = params.velocity*std::sin(p.currentAngle);
+        }
+    }
+
+    void step() override {
+        const int nParticles = params.nParticles;
+        const float xMax = params.width, yMax = params.height;
+        const float interactionRadius = params.interactionRadius;
+        const float inRadiusSquared = interactionRadius*interactionRadius;
+
+        std::vector<Particle> newSwarm = swarm;
+        std::vector<Particle> outsiders;
+        for (int i = 0; i<nParticles; i++){
+            fillPadding(swarm[i], outsiders, xMax, yMax, interactionRadius);
+        }
+
+        for (int i = 0; i<nParticles; i++){
+            float vX = 0;
+            float vY = 0;
+            int parts = 0;
+            for (int j = 0; j<nParticles; j++){
+                if (inRadius(interactionRadius, inRadiusSquared, swarm[i].pos, swarm[j].pos)){
+                    vX += swarm[j].vel[0];
+                    vY += swarm[j].vel[1];
+                    parts ++;
+                }
+            }
+            for (const Particle& other : outsiders){
+                if (inRadius(interactionRadius, inRadiusSquared, swarm[i].pos, other.pos)){
+                    vX += other.vel[0];
+                    vY += other.vel[1];
+                    parts ++;
+                }
+            }
+            vY = vY/(params.velocity*parts);
+            vX = vX/(params.velocity*parts);
+            float newAngle = std::atan2(vY, vX) + counterUniform(params.seed, iteration, i)*params.noise;
+
+            Particle& p = newSwarm[i];
+            p.vel[0] = params.velocity*std::cos(newAngle);
+            p.vel[1] = params.velocity*std::sin(newAngle);
+            p.currentAngle = newAngle;
+            p.pos[0] += p.vel[0];
+            p.pos[1] += p.vel[1];
+            if (p.pos[0] > xMax) {
+                p.pos[0]=0;
+            } else if (p.pos[0] < 0) {
+                p.pos[0] = xMax;
+            } else if (p.pos[1] > yMax) {
+                p.pos[1]=0;
+            } else if (p.pos[1] < 0) {
+                p.pos[1] = yMax;
+            }
+        }
+        swarm.swap(newSwarm);
+        iteration++;
+    }
+
+private:
+    Params params;
+    std::vector<Particle> swarm;
+    long iteration = 0;
+
+    static bool inRadius(float interactionRadius, float interactionRadius2, const float posCenter[], const float posOther[]){
+        if (posCenter[0] < posOther[0]-interactionRadius || posCenter[0] > posOther[0]+interactionRadius)
+           return false;
+        if (posCenter[1] < posOther[1]-interactionRadius || posCenter[1] > posOther[1]+interactionRadius)
+           return false;
+        float diff = std::pow(posCenter[0]-posOther[0],2)+std::pow(posCenter[1]-posOther[1],2);
+        return diff < interactionRadius2;
+    }
+
+    static void fillPadding(Particle p, std::vector<Particle> &outsiders, float xMax, float yMax, float interactionRadius) {
+        bool add = false;
+        if (p.pos[0] + interactionRadius > xMax) {
+            p.pos[0] -= xMax;
+            add = true;
+        } else if (p.pos[0] - interactionRadius < 0) {
+            p.pos[0] += xMax;
+            add = true;
+        }
+        if (p.pos[1] + interactionRadius > yMax) {
+            p.pos[1] -= yMax;
+            add = true;
+        } else if (p.pos[1] - interactionRadius < 0) {
+            p.pos[1] += yMax;
+            add = true;
+        }
+        if (add) {
+            outsiders.push_back(p);
+        }
+    }
+};
+
+
+struct BenchEngine {
+    std::string name;
+    int maxParticles;                   // Larger systems are skipped (O(N^2) engines)
+    std::function<std::unique_ptr<BenchCase>(const Params&)> make;
+};
+
+
+// Factory for a Simulation with the given engine settings
+std::function<std::unique_ptr<BenchCase>(const Params&)> simulationCase(Engine engine, int reorderEvery, bool fastMath){
+    return [=](const Params& base) {
+        Params params = base;
+        params.engine = engine;
+        params.reorderEvery = reorderEvery;
+        params.fastMath = fastMath;
+        return std::unique_ptr<BenchCase>(new SimulationCase(params));
+    };
+}
+
+
+std::vector<BenchEngine> benchEngines(){
+    return {
+        {"aos",             20000,   [](const Params& p) { return std::unique_ptr<BenchCase>(new AosCase(p)); }},
+        {"brute-force",     50000,   simulationCase(Engine::BruteForce, 0, false)},
+        {"quadtree",        1 << 30, simulationCase(Engine::Quadtree, 0, false)},
+        {"flat-quadtree",   1 << 30, simulationCase(Engine::FlatQuadtree, 0, false)},
+        {"cells",           1 << 30, simulationCase(Engine::CellList, 0, false)},
+        {"cells-reorder",   1 << 30, simulationCase(Engine::CellList, 20, false)},
+        {"cells-fast-math", 1 << 30, simulationCase(Engine::CellList, 20, true)},
+        {"cells-verlet",    1 << 30, [](const Params& base) {
+            // The shortest skin --verlet accepts; lists pay at small v0 and low density
+            Params params = base;
+            params.skin = 10 * params.velocity;
+            return std::unique_ptr<BenchCase>(new SimulationCase(params));
+        }},
+        {"cells-knn7",      1 << 30, [](const Params& base) {
+            Params params = base;
+            params.topological = 7;
+            return std::unique_ptr<BenchCase>(new SimulationCase(params));
+        }},
+        {"compact",         1 << 30, [](const Params& p) { return std::unique_ptr<BenchCase>(new CompactCase(p)); }},
+        {"swarm-3d",        1 << 30, [](const Params& p) { return std::unique_ptr<BenchCase>(new SwarmCase(p)); }},
+    };
+}
+
+
+void printUsage(const char* prog){
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --n <list>          particle counts (default 1000,4000,16000,64000,256000)\n"
+              << "  --density <list>    particles per unit area, the box is square (default 0.01)\n"
+              << "  --engines <names>   comma separated subset of the engines below (default all)\n"
+              << "  --steps <int>       timed steps per measurement (default 20)\n"
+              << "  --warmup <int>      untimed steps before measuring (default 5)\n"
+              << "  --noise <float>     noise amplitude (default 0.7)\n"
+              << "  --radius <float>    interaction radius (default 10)\n"
+              << "  --velocity <float>  particle speed (default 2)\n"
+              << "  --threads <int>     number of OpenMP threads\n"
+              << "  --csv <file>        also write the results as CSV\n"
+              << "Engines:";
+    for (const BenchEngine& engine : benchEngines()) {
+        std::cerr << " " << engine.name;
+    }
+    std::cerr << "\n";
+}
+
+
+int main(int argc, char * argv[]){
+    std::vector<float> sizes = {1000, 4000, 16000, 64000, 256000};
+    std::vector<float> densities = {0.01f};
+    std::vector<BenchEngine> engines = benchEngines();
+    long steps = 20, warmup = 5;
+    std::string csvPath;
+    Params base;
+    base.seed = 1;
+    base.randomSeed = false;
+
+    for (int i = 1; i<argc; i++){
+        const char* arg = argv[i];
+        const char* value = (i+1 < argc) ? argv[i+1] : nullptr;
+        if (value == nullptr) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (std::strcmp(arg, "--n") == 0) {
+            if (!parseList(value, sizes)) { printUsage(argv[0]); return 1; }
+        } else if (std::strcmp(arg, "--density") == 0) {
+            if (!parseList(value, densities)) { printUsage(argv[0]); return 1; }
+        } else if (std::strcmp(arg, "--engines") == 0) {
+            std::vector<BenchEngine> all = benchEngines();
+            std::string names = std::string(",") + value + ",";
+            // Every listed name has to be an engine, a typo must not shrink the run
+            for (size_t start = 1, end; start < names.size(); start = end + 1) {
+                end = names.find(',', start);
+                std::string name = names.substr(start, end - start);
+                bool known = name.empty();
+                for (const BenchEngine& engine : all) known = known || engine.name == name;
+                if (!known) {
+                    std::cerr << "Unknown engine: " << name << "\n";
+                    printUsage(argv[0]);
+                    return 1;
+                }
+            }
+            engines.clear();
+            for (const BenchEngine& engine : all) {
+                if (names.find("," + engine.name + ",") != std::string::npos) engines.push_back(engine);
+            }
+        } else if (std::strcmp(arg, "--steps") == 0) {
+            steps = std::atol(value);
+        } else if (std::strcmp(arg, "--warmup") == 0) {
+            warmup = std::atol(value);
+        } else if (std::strcmp(arg, "--noise") == 0) {
+            base.noise = std::atof(value);
+        } else if (std::strcmp(arg, "--radius") == 0) {
+            base.interactionRadius = std::atof(value);
+        } else if (std::strcmp(arg, "--velocity") == 0) {
+            base.velocity = std::atof(value);
+        } else if (std::strcmp(arg, "--threads") == 0) {
+#ifdef _OPENMP
+            omp_set_num_threads(std::atoi(value));
+#endif
+        } else if (std::strcmp(arg, "--csv") == 0) {
+            csvPath = value;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+    if (engines.empty() || steps <= 0 || warmup < 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::ofstream csv;
+    if (!csvPath.empty()) {
+        csv.open(csvPath);
+        if (!csv) {
+            std::cerr << "Could not open " << csvPath << "\n";
+            return 1;
+        }
+        csv << "engine,density,particles,box,steps_per_s,ns_per_particle_step,scaling_exponent\n";
+    }
+
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    std::cout << "threads " << threads << ", kernel " << neighborKernelName()
+              << ", radius " << base.interactionRadius << ", noise " << base.noise << ", v0 " << base.velocity
+              << ", " << steps << " steps after " << warmup << " warm-up\n";
+    std::cout << std::left << std::setw(17) << "engine" << std::right
+              << std::setw(9) << "density" << std::setw(10) << "N" << std::setw(10) << "box"
+              << std::setw(12) << "steps/s" << std::setw(14) << "ns/particle" << std::setw(9) << "scaling" << "\n";
+
+    // Scaling is the slope of log(time per step) against log(N) from the previous size
+    for (const BenchEngine& engine : engines) {
+        for (float density : densities) {
+            double lastN = 0, lastTime = 0;
+            for (float size : sizes) {
+                int n = int(size);
+                if (n > engine.maxParticles) continue;
+                Params params = base;
+                params.nParticles = n;
+                params.width = params.height = std::sqrt(n / density);
+
+                std::unique_ptr<BenchCase> bench = engine.make(params);
+                for (long s = 0; s<warmup; s++){
+                    bench->step();
+                }
+                auto start = std::chrono::steady_clock::now();
+                for (long s = 0; s<steps; s++){
+                    bench->step();
+                }
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                double perStep = seconds / steps;
+                double nsPerParticle = perStep * 1e9 / n;
+                double scaling = lastN > 0 ? std::log(perStep / lastTime) / std::log(n / lastN) : NAN;
+                lastN = n;
+                lastTime = perStep;
+
+                std::cout << std::left << std::setw(17) << engine.name << std::right
+                          << std::setw(9) << density << std::setw(10) << n << std::setw(10) << std::fixed
+                          << std::setprecision(0) << params.width << std::setw(12) << std::setprecision(1)
+                          << 1.0 / perStep << std::setw(14) << nsPerParticle << std::setw(9)
+                          << std::setprecision(2) << scaling << std::defaultfloat << std::setprecision(6) << "\n";
+                if (csv.is_open()) {
+                    csv << engine.name << "," << density << "," << n << "," << params.width << ","
+                        << 1.0 / perStep << "," << nsPerParticle << "," << scaling << "\n";
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "morton.h"
+#include "simd_kernel.h"
+
+
+// Uniform grid of square-ish cells with side >= interaction radius, rebuilt
+// every step with a counting sort. Positions and velocities are copied into
+// cell order so a neighbour search only walks the 3x3 block of cells around
+// a particle, reading contiguous memory.
+// Periodic boundaries are handled by wrapping the cell index and shifting
+// the candidate position by one box length, so no ghost particles exist.
+class CellList {
+public:
+    int cellsX = 0, cellsY = 0;     // Number of cells along each axis
+    float cellWidth = 0, cellHeight = 0;
+    float width = 0, height = 0;    // Size of the periodic box
+
+    std::vector<int> cellStart;     // First slot of each cell, size nCells+1
+    std::vector<int> index;         // Original particle index of each slot
+    std::vector<float> posX, posY;  // Positions in cell order
+    std::vector<float> velX, velY;  // Velocities in cell order
+
+    // Bin particles into cells of side >= cellSize (normally interactionRadius).
+    // Positions are expected to be inside [0, width] x [0, height].
+    void build(const float* x, const float* y, const float* vx, const float* vy,
+               int n, float width_, float height_, float cellSize) {
+        width = width_;
+        height = height_;
+        cellsX = std::max(1, int(width / cellSize));
+        cellsY = std::max(1, int(height / cellSize));
+        cellWidth = width / cellsX;
+        cellHeight = height / cellsY;
+
+        cellOf.resize(n);
+        index.resize(n);
+        posX.resize(n);
+        posY.resize(n);
+        velX.resize(n);
+        velY.resize(n);
+
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            cellOf[i] = cellId(x[i], y[i]);
+        }
+        bin(n);
+        gather(x, y, vx, vy, n);
+    }
+
+    // Same result as build() for particles that moved since the last build
+    // or update, but only the particles that changed cell are re-binned:
+    // they are collected in parallel and radix sorted by source and by
+    // destination cell, then only the cells they touch are rewritten; the
+    // slots of all other cells are block copies. Particles stay ordered by
+    // index within a cell, exactly as the counting sort leaves them. This
+    // pays off when few particles cross a cell edge per step, see
+    // updatePays(); past maxMovedFraction the counting sort is run on the
+    // new cells instead, which costs no more than build(). Falls back to
+    // build() when the grid or the particle count changed, or after
+    // invalidate().
+    void update(const float* x, const float* y, const float* vx, const float* vy,
+                int n, float width_, float height_, float cellSize) {
+        int newCellsX = std::max(1, int(width_ / cellSize));
+        int newCellsY = std::max(1, int(height_ / cellSize));
+        if (int(cellOf.size()) != n || width_ != width || height_ != height ||
+            newCellsX != cellsX || newCellsY != cellsY || cellStart.empty()) {
+            build(x, y, vx, vy, n, width_, height_, cellSize);
+            return;
+        }
+        const int nCells = cellsX * cellsY;
+
+        // New cell of every particle, and the particles that left their cell
+        // in index order: per-block counts, offsets, then the block copies
+        const int block = 4096;
+        const int nBlocks = (n + block - 1) / block;
+        nextCellOf.resize(n);
+        blockMoved.assign(nBlocks + 1, 0);
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < nBlocks; b++) {
+            int count = 0;
+            for (int i = b * block; i < std::min(n, (b + 1) * block); i++) {
+                nextCellOf[i] = cellId(x[i], y[i]);
+                count += nextCellOf[i] != cellOf[i];
+            }
+            blockMoved[b + 1] = count;
+        }
+        for (int b = 0; b < nBlocks; b++) {
+            blockMoved[b + 1] += blockMoved[b];
+        }
+        moved.resize(blockMoved[nBlocks]);
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < nBlocks; b++) {
+            int next = blockMoved[b];
+            for (int i = b * block; i < std::min(n, (b + 1) * block); i++) {
+                if (nextCellOf[i] != cellOf[i]) moved[next++] = i;
+            }
+        }
+
+        if (moved.size() > maxMovedFraction * n) {
+            std::swap(cellOf, nextCellOf);
+            bin(n);
+        } else if (!moved.empty()) {
+            // Arrivals sorted by destination and departures by source cell.
+            // The sorts are stable, so arrivals stay in index order.
+            const int nMoved = moved.size();
+            arrivals.assign(moved.begin(), moved.end());
+            departures.assign(moved.begin(), moved.end());
+            arrivalCell.resize(nMoved);
+            departureCell.resize(nMoved);
+            for (int k = 0; k < nMoved; k++) {
+                arrivalCell[k] = nextCellOf[moved[k]];
+                departureCell[k] = cellOf[moved[k]];
+            }
+            radixSortByKey(arrivalCell, arrivals, sortKeysTmp, sortOrderTmp);
+            radixSortByKey(departureCell, departures, sortKeysTmp, sortOrderTmp);
+
+            // Walk the touched cells in order. The runs of untouched cells in
+            // between are copied as one block, only shifted; a touched cell
+            // merges the particles that stay with its arrivals by index.
+            nextStart.resize(nCells + 1);
+            nextIndex.resize(n);
+            int a = 0, d = 0, out = 0, cell = 0;    // cell: first cell not written yet
+            while (true) {
+                int c = std::min(a < nMoved ? int(arrivalCell[a]) : nCells,
+                                 d < nMoved ? int(departureCell[d]) : nCells);
+                int shift = out - cellStart[cell];
+                for (int u = cell; u < c; u++) {
+                    nextStart[u] = cellStart[u] + shift;
+                }
+                std::copy(index.begin() + cellStart[cell], index.begin() + cellStart[c], nextIndex.begin() + out);
+                out += cellStart[c] - cellStart[cell];
+                if (c == nCells) break;
+
+                nextStart[c] = out;
+                int lastArrival = a;
+                while (lastArrival < nMoved && int(arrivalCell[lastArrival]) == c) lastArrival++;
+                while (d < nMoved && int(departureCell[d]) == c) d++;
+                for (int slot = cellStart[c]; slot < cellStart[c + 1]; slot++) {
+                    int i = index[slot];
+                    if (nextCellOf[i] != c) continue;       // Departed
+                    while (a < lastArrival && arrivals[a] < i) nextIndex[out++] = arrivals[a++];
+                    nextIndex[out++] = i;
+                }
+                while (a < lastArrival) nextIndex[out++] = arrivals[a++];
+                cell = c + 1;
+            }
+            nextStart[nCells] = n;
+            std::swap(index, nextIndex);
+            std::swap(cellStart, nextStart);
+            std::swap(cellOf, nextCellOf);
+        }
+        gather(x, y, vx, vy, n);
+    }
+
+    // Share of particles expected to change cell in a step of the given
+    // length along a uniformly random heading: a step (dx, dy) crosses an
+    // edge with probability |dx|/L + |dy|/L - |dx dy|/L^2, which averages
+    // to s (4 - s) / pi for s = step / L.
+    static float expectedMovedFraction(float step, float cellSize) {
+        float s = std::min(step / cellSize, 1.0f);
+        return s * (4 - s) / 3.14159265f;
+    }
+
+    // Whether update() should beat build() for particles moving step per
+    // update on cells of about cellSize. Otherwise it collects the movers
+    // only to fall back to the counting sort, a scan more than build().
+    static bool updatePays(float step, float cellSize) {
+        return expectedMovedFraction(step, cellSize) <= maxMovedFraction;
+    }
+
+    // Force the next update() to build from scratch, e.g. after the
+    // particles were renumbered
+    void invalidate() {
+        cellStart.clear();
+    }
+
+    int cellId(float x, float y) const {
+        int cx = std::min(std::max(int(x / cellWidth), 0), cellsX - 1);
+        int cy = std::min(std::max(int(y / cellHeight), 0), cellsY - 1);
+        return cy * cellsX + cx;
+    }
+
+    // Call visit(first, last, shiftX, shiftY) for each of the 3x3 cells around
+    // (x, y). [first, last) is the slot range of the cell and the shift has
+    // to be added to its positions to get the periodic image closest to (x, y).
+    // With fewer than three cells along an axis the same cell is visited with
+    // different shifts, which is still exact as long as radius <= box/2.
+    template <typename Visitor>
+    void forEachNeighborCell(float x, float y, Visitor&& visit) const {
+        int cx = std::min(std::max(int(x / cellWidth), 0), cellsX - 1);
+        int cy = std::min(std::max(int(y / cellHeight), 0), cellsY - 1);
+        for (int oy = -1; oy <= 1; oy++) {
+            int ny = cy + oy;
+            float shiftY = 0;
+            if (ny < 0) { ny += cellsY; shiftY = -height; }
+            else if (ny >= cellsY) { ny -= cellsY; shiftY = height; }
+            for (int ox = -1; ox <= 1; ox++) {
+                int nx = cx + ox;
+                float shiftX = 0;
+                if (nx < 0) { nx += cellsX; shiftX = -width; }
+                else if (nx >= cellsX) { nx -= cellsX; shiftX = width; }
+                int c = ny * cellsX + nx;
+                visit(cellStart[c], cellStart[c + 1], shiftX, shiftY);
+            }
+        }
+    }
+
+    // Sum velocities of all particles within radius of (x, y), itself included
+    void accumulate(float x, float y, float radius2, float& vX, float& vY, int& parts) const {
+        NeighborKernel kernel = activeNeighborKernel();
+        forEachNeighborCell(x, y, [&](int first, int last, float shiftX, float shiftY) {
+            // Shift the target instead of the candidates so the block is read as is
+            kernel(posX.data() + first, posY.data() + first, velX.data() + first, velY.data() + first, last - first,
+                   x - shiftX, y - shiftY, radius2, vX, vY, parts);
+        });
+    }
+
+    // The k particles nearest to (x, y) under the periodic minimum image,
+    // nearest first: their slots go to slot[] and squared distances to
+    // dist2[]. Rings of cells are searched outwards until the next ring
+    // cannot hold anything closer than the k-th found so far. Returns the
+    // number found, which is k unless there are fewer particles.
+    int nearest(float x, float y, int k, int* slot, float* dist2) const {
+        int cx = std::min(std::max(int(x / cellWidth), 0), cellsX - 1);
+        int cy = std::min(std::max(int(y / cellHeight), 0), cellsY - 1);
+        // Offsets lo..hi along an axis reach every cell exactly once, and
+        // every other image of such a cell is at least as many cells away
+        int loX = -((cellsX - 1) / 2), hiX = cellsX / 2;
+        int loY = -((cellsY - 1) / 2), hiY = cellsY / 2;
+        int lastRing = std::max(std::max(-loX, hiX), std::max(-loY, hiY));
+        int found = 0;
+
+        auto scanCell = [&](int ox, int oy) {
+            int nx = cx + ox, ny = cy + oy;
+            nx = nx < 0 ? nx + cellsX : (nx >= cellsX ? nx - cellsX : nx);
+            ny = ny < 0 ? ny + cellsY : (ny >= cellsY ? ny - cellsY : ny);
+            int c = ny * cellsX + nx;
+            for (int s = cellStart[c]; s < cellStart[c + 1]; s++) {
+                float dx = x - posX[s], dy = y - posY[s];
+                dx = dx > width / 2 ? dx - width : (dx < -width / 2 ? dx + width : dx);
+                dy = dy > height / 2 ? dy - height : (dy < -height / 2 ? dy + height : dy);
+                float d2 = dx * dx + dy * dy;
+                if (found == k && d2 >= dist2[k - 1]) continue;
+                // Insertion into the sorted list, k is small
+                int j = found < k ? found++ : k - 1;
+                for (; j > 0 && dist2[j - 1] > d2; j--) {
+                    dist2[j] = dist2[j - 1];
+                    slot[j] = slot[j - 1];
+                }
+                dist2[j] = d2;
+                slot[j] = s;
+            }
+        };
+
+        for (int r = 0; r <= lastRing; r++) {
+            if (found == k && r > 0) {
+                // Distance to the outside of the (2r-1) x (2r-1) cells already searched
+                float bound = std::min(std::min(x - (cx - r + 1) * cellWidth, (cx + r) * cellWidth - x),
+                                       std::min(y - (cy - r + 1) * cellHeight, (cy + r) * cellHeight - y));
+                if (bound * bound > dist2[k - 1]) break;
+            }
+            for (int oy = std::max(-r, loY); oy <= std::min(r, hiY); oy++) {
+                if (oy == -r || oy == r) {
+                    for (int ox = std::max(-r, loX); ox <= std::min(r, hiX); ox++) scanCell(ox, oy);
+                } else {
+                    if (-r >= loX) scanCell(-r, oy);
+                    if (r <= hiX) scanCell(r, oy);
+                }
+            }
+        }
+        return found;
+    }
+
+private:
+    std::vector<int> cellOf;        // Cell of each particle (original order)
+    std::vector<int> fill;          // Scatter cursor per cell
+
+    // Buffers of update()
+    std::vector<int> nextCellOf, blockMoved, moved, arrivals, departures, nextStart, nextIndex, sortOrderTmp;
+    std::vector<uint32_t> arrivalCell, departureCell, sortKeysTmp;
+
+    // Share of particles changing cell above which update() re-bins all
+    static constexpr float maxMovedFraction = 0.03125f;
+
+    // Counting sort of cellOf: histogram, exclusive prefix sum, scatter
+    void bin(int n) {
+        int nCells = cellsX * cellsY;
+        cellStart.assign(nCells + 1, 0);
+        for (int i = 0; i < n; i++) {
+            cellStart[cellOf[i] + 1]++;
+        }
+        for (int c = 0; c < nCells; c++) {
+            cellStart[c + 1] += cellStart[c];
+        }
+        fill.assign(cellStart.begin(), cellStart.end() - 1);
+        for (int i = 0; i < n; i++) {
+            index[fill[cellOf[i]]++] = i;
+        }
+    }
+
+    // Positions and velocities into cell order, independent per slot
+    void gather(const float* x, const float* y, const float* vx, const float* vy, int n) {
+        #pragma omp parallel for schedule(static)
+        for (int slot = 0; slot < n; slot++) {
+            int i = index[slot];
+            posX[slot] = x[i];
+            posY[slot] = y[i];
+            velX[slot] = vx[i];
+            velY[slot] = vy[i];
+        }
+    }
+};
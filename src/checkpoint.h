@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "simulation.h"
+
+
+// Binary checkpoint with everything needed to continue a run bit-exactly:
+//   CheckpointHeader, then posX, posY, velX, velY, angles (float[n]) and ids (int32[n]).
+// Noise is a pure function of (seed, step, id), so the seed and the step
+// counter are the whole random generator state. The interaction rule, the
+// noise distribution and the settings that change the float summation order
+// (engine, reordering, fast-math) are stored as well. Version 1 files end
+// the header at topological and are read with uniform noise.
+// Results are only bit-exact with the same SIMD kernel (--simd) and --verlet;
+// saving restarts the Verlet lists of the running simulation, like a restart
+// from the file does, so both sum the same lists in the same order.
+
+struct CheckpointHeader {
+    char magic[8];                  // "VICSEKCP"
+    uint32_t version;
+    uint32_t nParticles;
+    float width, height;
+    float radius, velocity;
+    float noise, interactionRadius;
+    uint64_t seed;
+    uint64_t iteration;
+    uint32_t engine;
+    uint32_t reorderEvery;
+    uint32_t fastMath;
+    uint32_t topological;           // 0 in checkpoints from before the topological rule
+    uint32_t noiseDistribution;     // Version 2 on
+    uint32_t reserved;
+};
+static_assert(sizeof(CheckpointHeader) == 80, "CheckpointHeader must have no padding");
+const size_t checkpointHeaderV1 = 72;
+
+
+// Read the header of either version, leaving the file at the particle data
+inline bool readCheckpointHeader(FILE* file, CheckpointHeader& header) {
+    header = {};
+    if (fread(&header, checkpointHeaderV1, 1, file) != 1 || memcmp(header.magic, "VICSEKCP", 8) != 0) {
+        return false;
+    }
+    if (header.version == 1) return true;
+    return header.version == 2 &&
+           fread((char*)&header + checkpointHeaderV1, sizeof(header) - checkpointHeaderV1, 1, file) == 1;
+}
+
+
+// Write to path.tmp and rename over path, so a crash while writing never
+// leaves a half-written checkpoint behind. Restarts the Verlet lists, see above.
+inline bool saveCheckpoint(Simulation& sim, const std::string& path) {
+    sim.resetNeighborLists();
+    const Params& params = sim.params;
+    std::string tmpPath = path + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (file == NULL) {
+        std::cerr << "Could not open checkpoint file " << tmpPath << "\n";
+        return false;
+    }
+
+    CheckpointHeader header = {};
+    memcpy(header.magic, "VICSEKCP", 8);
+    header.version = 2;
+    header.nParticles = params.nParticles;
+    header.width = params.width;
+    header.height = params.height;
+    header.radius = params.radius;
+    header.velocity = params.velocity;
+    header.noise = params.noise;
+    header.interactionRadius = params.interactionRadius;
+    header.seed = params.seed;
+    header.iteration = sim.iteration;
+    header.engine = uint32_t(params.engine);
+    header.reorderEvery = params.reorderEvery;
+    header.fastMath = params.fastMath;
+    header.topological = params.topological;
+    header.noiseDistribution = uint32_t(params.noiseDistribution);
+
+    size_t n = params.nParticles;
+    size_t written = fwrite(&header, sizeof(header), 1, file);
+    written += fwrite(sim.posX.data(), sizeof(float), n, file);
+    written += fwrite(sim.posY.data(), sizeof(float), n, file);
+    written += fwrite(sim.velX.data(), sizeof(float), n, file);
+    written += fwrite(sim.velY.data(), sizeof(float), n, file);
+    written += fwrite(sim.angles.data(), sizeof(float), n, file);
+    written += fwrite(sim.ids.data(), sizeof(int), n, file);
+    bool ok = written == 1 + 6*n && fflush(file) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    ok = ok && rename(tmpPath.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        std::cerr << "Error while writing checkpoint " << path << "\n";
+    }
+    return ok;
+}
+
+
+// Replace the physics and ordering settings in params by the ones stored in
+// the checkpoint; run control (steps, outputs, threads) is left alone
+inline bool readCheckpointParams(const std::string& path, Params& params) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        std::cerr << "Could not open checkpoint " << path << "\n";
+        return false;
+    }
+    CheckpointHeader header;
+    bool ok = readCheckpointHeader(file, header);
+    fclose(file);
+    if (!ok) {
+        std::cerr << "Not a checkpoint file: " << path << "\n";
+        return false;
+    }
+    params.nParticles = header.nParticles;
+    params.width = header.width;
+    params.height = header.height;
+    params.radius = header.radius;
+    params.velocity = header.velocity;
+    params.noise = header.noise;
+    params.interactionRadius = header.interactionRadius;
+    params.seed = header.seed;
+    params.randomSeed = false;
+    params.engine = Engine(header.engine);
+    params.reorderEvery = header.reorderEvery;
+    params.fastMath = header.fastMath != 0;
+    params.topological = header.topological;
+    params.noiseDistribution = NoiseDistribution(header.noiseDistribution);
+    return true;
+}
+
+
+// Load the particle state and step counter into a simulation created with
+// the params from readCheckpointParams
+inline bool loadCheckpoint(const std::string& path, Simulation& sim) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        std::cerr << "Could not open checkpoint " << path << "\n";
+        return false;
+    }
+    CheckpointHeader header;
+    size_t n = sim.params.nParticles;
+    bool ok = readCheckpointHeader(file, header) && header.nParticles == n;
+    size_t read = 0;
+    if (ok) {
+        read += fread(sim.posX.data(), sizeof(float), n, file);
+        read += fread(sim.posY.data(), sizeof(float), n, file);
+        read += fread(sim.velX.data(), sizeof(float), n, file);
+        read += fread(sim.velY.data(), sizeof(float), n, file);
+        read += fread(sim.angles.data(), sizeof(float), n, file);
+        read += fread(sim.ids.data(), sizeof(int), n, file);
+    }
+    fclose(file);
+    if (!ok || read != 6*n) {
+        std::cerr << "Checkpoint " << path << " is truncated or does not match\n";
+        return false;
+    }
+    sim.iteration = header.iteration;
+    return true;
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "noise.h"
+#include "simd_kernel.h"
+#include "simulation.h"
+
+
+// Sum the unit headings of the count slots within radius of (xi, yi), in
+// 16-bit coordinates. Written once and compiled per instruction set below:
+// the heading lookups need gathers, which the baseline x86-64 lacks.
+typedef void (*CompactKernel)(const uint16_t* qx, const uint16_t* qy, const uint16_t* heading, int count,
+                              uint16_t xi, uint16_t yi, float scaleX, float scaleY, float radius2,
+                              const float* cosTable, const float* sinTable,
+                              float& sumX, float& sumY, int& parts);
+
+inline __attribute__((always_inline))
+void compactBlock(const uint16_t* qx, const uint16_t* qy, const uint16_t* heading, int count,
+                  uint16_t xi, uint16_t yi, float scaleX, float scaleY, float radius2,
+                  const float* cosTable, const float* sinTable,
+                  float& sumX, float& sumY, int& parts) {
+    float blockX = 0, blockY = 0;
+    int found = 0;
+    #pragma omp simd reduction(+:blockX,blockY,found)
+    for (int j = 0; j < count; j++) {
+        float dx = int16_t(uint16_t(qx[j] - xi)) * scaleX;
+        float dy = int16_t(uint16_t(qy[j] - yi)) * scaleY;
+        // Unconditional lookups and a 0/1 factor instead of a branch, or
+        // the loop does not vectorize once inlined into the wrappers below
+        float inside = dx * dx + dy * dy <= radius2 ? 1.0f : 0.0f;
+        blockX += inside * cosTable[heading[j]];
+        blockY += inside * sinTable[heading[j]];
+        found += int(inside);
+    }
+    sumX += blockX;
+    sumY += blockY;
+    parts += found;
+}
+
+inline void compactBlockScalar(const uint16_t* qx, const uint16_t* qy, const uint16_t* heading, int count,
+                               uint16_t xi, uint16_t yi, float scaleX, float scaleY, float radius2,
+                               const float* cosTable, const float* sinTable,
+                               float& sumX, float& sumY, int& parts) {
+    compactBlock(qx, qy, heading, count, xi, yi, scaleX, scaleY, radius2, cosTable, sinTable, sumX, sumY, parts);
+}
+
+#ifdef VICSEK_X86_SIMD
+__attribute__((target("avx2")))
+inline void compactBlockAVX2(const uint16_t* qx, const uint16_t* qy, const uint16_t* heading, int count,
+                             uint16_t xi, uint16_t yi, float scaleX, float scaleY, float radius2,
+                             const float* cosTable, const float* sinTable,
+                             float& sumX, float& sumY, int& parts) {
+    compactBlock(qx, qy, heading, count, xi, yi, scaleX, scaleY, radius2, cosTable, sinTable, sumX, sumY, parts);
+}
+
+__attribute__((target("avx512f")))
+inline void compactBlockAVX512(const uint16_t* qx, const uint16_t* qy, const uint16_t* heading, int count,
+                               uint16_t xi, uint16_t yi, float scaleX, float scaleY, float radius2,
+                               const float* cosTable, const float* sinTable,
+                               float& sumX, float& sumY, int& parts) {
+    compactBlock(qx, qy, heading, count, xi, yi, scaleX, scaleY, radius2, cosTable, sinTable, sumX, sumY, parts);
+}
+#endif
+
+
+// Same instruction set as the float kernel chosen with --simd
+inline CompactKernel compactKernel() {
+#ifdef VICSEK_X86_SIMD
+    if (activeNeighborKernel() == accumulateBlockAVX512) return compactBlockAVX512;
+    if (activeNeighborKernel() == accumulateBlockAVX2) return compactBlockAVX2;
+#endif
+    return compactBlockScalar;
+}
+
+
+// Vicsek model on a quantized state for very large, memory-bound runs.
+// Positions are 16-bit fixed point fractions of the box and headings 16-bit
+// fractions of a full turn; the velocity is v0 times the heading's unit
+// vector and is never stored. That is 10 bytes per particle with the id,
+// 24 with the double buffer and the noise angles, against 64 for Simulation
+// with a CellList.
+//
+// The box is exactly 2^16 units along each axis, so the difference of two
+// coordinates taken as int16 is already the minimum image: the periodic
+// boundary costs nothing. The cell of a coordinate is (q * cells) >> 16,
+// one multiply. Particles are kept in cell order, so every neighbour scan
+// reads contiguous memory.
+//
+// Positions move by whole grid steps of width / 65536, so the box should be
+// small enough that v0 spans many of them (width < 650 v0 keeps the
+// rounding of a step below 1 %). Noise is keyed on (seed, step, id) like in
+// Simulation and the initial state is Simulation's, quantized.
+class CompactSimulation {
+public:
+    Params params;
+    long iteration = 0;
+
+    std::vector<uint16_t> qx, qy;   // x = qx * width / 65536
+    std::vector<uint16_t> heading;  // angle = heading * 2 pi / 65536
+    std::vector<int> ids;           // Particle id of each slot, slots follow the cells
+    Observables observables;        // Measured during the last step
+
+    CompactSimulation(const Params& params_): params(params_) {
+        int n = params.nParticles;
+        qx.resize(n);
+        qy.resize(n);
+        heading.resize(n);
+        ids.resize(n);
+        // Same initial state as Simulation(params), quantized
+        initialState(params, [&](int i, float x, float y, float angle) {
+            qx[i] = toFixed(x, params.width);
+            qy[i] = toFixed(y, params.height);
+            heading[i] = toTurn(angle);
+            ids[i] = i;
+        });
+        nextX.resize(n);
+        nextY.resize(n);
+        nextHeading.resize(n);
+        nextIds.resize(n);
+        noiseAngles.resize(n);
+    }
+
+    void step() {
+        const int nParticles = params.nParticles;
+        const float scaleX = params.width / 65536.0f;
+        const float scaleY = params.height / 65536.0f;
+        const float radius2 = params.interactionRadius * params.interactionRadius;
+        const float stepX = params.velocity / scaleX;     // Displacement in grid units
+        const float stepY = params.velocity / scaleY;
+        const float noise = params.noise;
+        const uint64_t seed = params.seed;
+        const uint64_t step = iteration;
+        const UnitTable& unit = unitTable();
+        const float* cosTable = unit.cos.data();
+        const float* sinTable = unit.sin.data();
+        const CompactKernel kernel = compactKernel();
+
+        sortByCell();
+        fillNoise(noiseAngles.data(), ids.data(), nParticles, seed, step, noise, params.noiseDistribution);
+
+        // Neighbour cells to visit per axis; with one or two cells per axis
+        // every cell is visited once, the int16 differences do the wrap
+        int offsetsX[3], offsetsY[3], nOffsetsX = 0, nOffsetsY = 0;
+        for (int o = cellsX < 3 ? 0 : -1; o <= (cellsX < 2 ? 0 : 1); o++) offsetsX[nOffsetsX++] = o;
+        for (int o = cellsY < 3 ? 0 : -1; o <= (cellsY < 2 ? 0 : 1); o++) offsetsY[nOffsetsY++] = o;
+
+        double sumUnitX = 0, sumUnitY = 0, sumParts = 0;
+        #pragma omp parallel for schedule(static) reduction(+:sumUnitX,sumUnitY,sumParts)
+        for (int i = 0; i < nParticles; i++) {
+            const uint16_t xi = qx[i], yi = qy[i];
+            const int cx = (xi * cellsX) >> 16, cy = (yi * cellsY) >> 16;
+            float sumX = 0, sumY = 0;
+            int parts = 0;
+            for (int a = 0; a < nOffsetsY; a++) {
+                int row = wrapCell(cy + offsetsY[a], cellsY) * cellsX;
+                if (cx >= 1 && cx + 1 < cellsX) {
+                    // The three cells of the row are contiguous in cell order
+                    int first = cellStart[row + cx - 1];
+                    kernel(qx.data() + first, qy.data() + first, heading.data() + first,
+                           cellStart[row + cx + 2] - first, xi, yi, scaleX, scaleY, radius2,
+                           cosTable, sinTable, sumX, sumY, parts);
+                    continue;
+                }
+                for (int b = 0; b < nOffsetsX; b++) {
+                    int cell = row + wrapCell(cx + offsetsX[b], cellsX);
+                    int first = cellStart[cell];
+                    kernel(qx.data() + first, qy.data() + first, heading.data() + first,
+                           cellStart[cell + 1] - first, xi, yi, scaleX, scaleY, radius2,
+                           cosTable, sinTable, sumX, sumY, parts);
+                }
+            }
+            float angle = std::atan2(sumY, sumX) + noiseAngles[i];
+            uint16_t h = toTurn(angle);
+            nextHeading[i] = h;
+            nextX[i] = uint16_t(xi + int(std::lrint(stepX * unit.cos[h])));
+            nextY[i] = uint16_t(yi + int(std::lrint(stepY * unit.sin[h])));
+            nextIds[i] = ids[i];
+            sumUnitX += unit.cos[h];
+            sumUnitY += unit.sin[h];
+            sumParts += parts;
+        }
+        std::swap(qx, nextX);
+        std::swap(qy, nextY);
+        std::swap(heading, nextHeading);
+        std::swap(ids, nextIds);
+        iteration++;
+
+        observables.step = iteration;
+        observables.polarOrder = std::sqrt(sumUnitX*sumUnitX + sumUnitY*sumUnitY) / nParticles;
+        observables.meanHeading = std::atan2(sumUnitY, sumUnitX);
+        observables.meanNeighbors = sumParts / nParticles - 1;     // parts includes the particle itself
+    }
+
+    // Replace the state by float positions and angles of particles 0..n-1
+    void pack(const float* posX, const float* posY, const float* angles) {
+        int n = params.nParticles;
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            qx[i] = toFixed(posX[i], params.width);
+            qy[i] = toFixed(posY[i], params.height);
+            heading[i] = toTurn(angles[i]);
+            ids[i] = i;
+        }
+    }
+
+    // Float positions and angles ordered by particle id
+    void unpack(std::vector<float>& posX, std::vector<float>& posY, std::vector<float>& angles) const {
+        int n = params.nParticles;
+        posX.resize(n);
+        posY.resize(n);
+        angles.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            posX[ids[i]] = qx[i] * (params.width / 65536.0f);
+            posY[ids[i]] = qy[i] * (params.height / 65536.0f);
+            angles[ids[i]] = int16_t(heading[i]) * (6.2831853f / 65536.0f);
+        }
+    }
+
+    static uint16_t toFixed(float x, float length) {
+        return uint16_t(std::lrint(x / length * 65536.0f));
+    }
+
+    // Any angle, wrapped to a full turn by the 16-bit overflow
+    static uint16_t toTurn(float angle) {
+        return uint16_t(std::lrint(angle * (65536.0f / 6.2831853f)));
+    }
+
+private:
+    std::vector<uint16_t> nextX, nextY, nextHeading;
+    std::vector<int> nextIds;
+    std::vector<float> noiseAngles;
+    std::vector<int> cellStart, fill;
+    int cellsX = 1, cellsY = 1;
+
+    // cos and sin of every 16-bit heading
+    struct UnitTable {
+        std::vector<float> cos, sin;
+        UnitTable(): cos(65536), sin(65536) {
+            for (int h = 0; h < 65536; h++) {
+                double angle = h * (6.283185307179586 / 65536);
+                cos[h] = float(std::cos(angle));
+                sin[h] = float(std::sin(angle));
+            }
+        }
+    };
+
+    static const UnitTable& unitTable() {
+        static const UnitTable table;
+        return table;
+    }
+
+    static int wrapCell(int c, int cells) {
+        return c < 0 ? c + cells : (c >= cells ? c - cells : c);
+    }
+
+    // Stable counting sort of all slots by cell into the next* arrays, which
+    // then become the current state
+    void sortByCell() {
+        const int n = params.nParticles;
+        // Cells at least a radius wide, at most 4096 per axis so q * cells fits an int
+        cellsX = std::min(std::max(1, int(params.width / params.interactionRadius)), 4096);
+        cellsY = std::min(std::max(1, int(params.height / params.interactionRadius)), 4096);
+        int nCells = cellsX * cellsY;
+
+        cellStart.assign(nCells + 1, 0);
+        for (int i = 0; i < n; i++) {
+            cellStart[cellOf(i) + 1]++;
+        }
+        for (int c = 0; c < nCells; c++) {
+            cellStart[c + 1] += cellStart[c];
+        }
+        fill.assign(cellStart.begin(), cellStart.end() - 1);
+        for (int i = 0; i < n; i++) {
+            int slot = fill[cellOf(i)]++;
+            nextX[slot] = qx[i];
+            nextY[slot] = qy[i];
+            nextHeading[slot] = heading[i];
+            nextIds[slot] = ids[i];
+        }
+        std::swap(qx, nextX);
+        std::swap(qy, nextY);
+        std::swap(heading, nextHeading);
+        std::swap(ids, nextIds);
+    }
+
+    int cellOf(int i) const {
+        return ((qy[i] * cellsY) >> 16) * cellsX + ((qx[i] * cellsX) >> 16);
+    }
+};
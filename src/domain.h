@@ -0,0 +1,267 @@
+#pragma once
+
+#include <mpi.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "cell_list.h"
+#include "noise.h"
+#include "simulation.h"
+
+
+// One MPI rank's share of the swarm. The box is cut into equal vertical
+// slabs, rank r owning x in [r, r+1) * width / ranks with periodic
+// neighbours. Every step:
+//   1. halo: particles within interactionRadius of a slab edge are copied
+//      to the neighbour on that side, shifted by the box width across the
+//      periodic boundary (the distributed form of fillPadding),
+//   2. the owned particles are updated with a CellList over the slab and
+//      both halos, exactly like Simulation's cell engine,
+//   3. migration: particles that moved out of the slab go to the neighbour.
+// Slabs must be at least interactionRadius and velocity wide, so both only
+// ever involve the two neighbours. Noise is keyed on (seed, step, id) and
+// the initial state is Simulation's, so runs can be compared directly.
+// Only the main thread calls MPI (MPI_THREAD_FUNNELED is enough).
+class SlabDomain {
+public:
+    Params params;
+    long iteration = 0;
+    int rank = 0, ranks = 1;
+    float x0 = 0, x1 = 0;           // Owned slab
+
+    // Owned particles
+    std::vector<float> posX, posY, velX, velY, angles;
+    std::vector<int> ids;
+    Observables observables;        // Global, identical on every rank
+    long haloCount = 0;             // Halo particles received in the last step
+    long migrated = 0;              // Particles that left this rank in the last step
+
+    SlabDomain(const Params& params_, MPI_Comm comm_): params(params_), comm(comm_) {
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &ranks);
+        slabWidth = params.width / ranks;
+        x0 = rank * slabWidth;
+        x1 = rank == ranks - 1 ? params.width : (rank + 1) * slabWidth;
+
+        // Every rank draws the whole initial state with the same seed and
+        // keeps its slab; the seed of rank 0 wins if it was random
+        if (params.randomSeed) {
+            std::random_device rand_dev;
+            unsigned int seed = rand_dev();
+            MPI_Bcast(&seed, 1, MPI_UNSIGNED, 0, comm);
+            params.seed = seed;
+            params.randomSeed = false;
+        }
+        initialState(params, [&](int i, float x, float y, float angle) {
+            if (ownerOf(x) != rank) return;
+            posX.push_back(x);
+            posY.push_back(y);
+            angles.push_back(angle);
+            velX.push_back(params.velocity*std::cos(angle));
+            velY.push_back(params.velocity*std::sin(angle));
+            ids.push_back(i);
+        });
+    }
+
+    // False if the slabs are too thin for neighbour-only exchange
+    bool valid() const {
+        return slabWidth >= params.interactionRadius && slabWidth >= params.velocity;
+    }
+
+    long localCount() const {
+        return posX.size();
+    }
+
+    void step() {
+        const float width = params.width;
+        const float height = params.height;
+        const float velocity = params.velocity;
+        const float noise = params.noise;
+        const float radius = params.interactionRadius;
+        const uint64_t seed = params.seed;
+        const uint64_t step = iteration;
+
+        exchangeHalo();
+
+        // Local frame: the slab plus a halo of one radius on each side.
+        // The cell list wraps in x over this frame, but any wrapped image
+        // is further than radius from an owned particle, so it never counts.
+        const int n = posX.size();
+        const float offset = x0 - radius;
+        const int total = n + int(haloX.size());
+        frameX.resize(total);
+        frameY.resize(total);
+        frameVelX.resize(total);
+        frameVelY.resize(total);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            frameX[i] = posX[i] - offset;
+            frameY[i] = posY[i];
+            frameVelX[i] = velX[i];
+            frameVelY[i] = velY[i];
+        }
+        for (size_t h = 0; h < haloX.size(); h++) {
+            frameX[n + h] = haloX[h] - offset;
+            frameY[n + h] = haloY[h];
+            frameVelX[n + h] = haloVelX[h];
+            frameVelY[n + h] = haloVelY[h];
+        }
+        cells.build(frameX.data(), frameY.data(), frameVelX.data(), frameVelY.data(), total,
+                    x1 - x0 + 2 * radius, height, radius);
+
+        noiseAngles.resize(n);
+        fillNoise(noiseAngles.data(), ids.data(), n, seed, step, noise, params.noiseDistribution);
+
+        double sumVelX = 0, sumVelY = 0, sumParts = 0;
+        #pragma omp parallel for schedule(static) reduction(+:sumVelX,sumVelY,sumParts)
+        for (int i = 0; i < n; i++) {
+            float vX = 0.0f, vY = 0.0f;
+            int parts = 0;
+            cells.accumulate(frameX[i], frameY[i], radius * radius, vX, vY, parts);
+            sumParts += parts;
+            if (parts > 0) {
+                vX /= (velocity * parts);
+                vY /= (velocity * parts);
+            }
+            float newAngle = std::atan2(vY, vX) + noiseAngles[i];
+            velX[i] = velocity * std::cos(newAngle);
+            velY[i] = velocity * std::sin(newAngle);
+            angles[i] = newAngle;
+            sumVelX += velX[i];
+            sumVelY += velY[i];
+            posX[i] = wrap(posX[i] + velX[i], width);
+            posY[i] = wrap(posY[i] + velY[i], height);
+        }
+
+        migrate();
+        iteration++;
+
+        double global[4], local[4] = {sumVelX, sumVelY, sumParts, double(n)};
+        MPI_Allreduce(local, global, 4, MPI_DOUBLE, MPI_SUM, comm);
+        observables.step = iteration;
+        observables.polarOrder = std::sqrt(global[0]*global[0] + global[1]*global[1]) / (global[3] * velocity);
+        observables.meanHeading = std::atan2(global[1], global[0]);
+        observables.meanNeighbors = global[2] / global[3] - 1;     // parts includes the particle itself
+    }
+
+private:
+    MPI_Comm comm;
+    float slabWidth = 0;
+
+    std::vector<float> haloX, haloY, haloVelX, haloVelY;
+    std::vector<float> frameX, frameY, frameVelX, frameVelY;
+    std::vector<float> noiseAngles;
+    CellList cells;
+
+    // Everything a particle carries between ranks
+    struct Migrant {
+        float x, y, velX, velY, angle;
+        int id;
+    };
+    struct HaloParticle {
+        float x, y, velX, velY;
+    };
+
+    static float wrap(float x, float length) {
+        return x >= length ? x - length : (x < 0 ? x + length : x);
+    }
+
+    int ownerOf(float x) const {
+        return std::min(std::max(int(x / slabWidth), 0), ranks - 1);
+    }
+
+    int left() const {
+        return (rank + ranks - 1) % ranks;
+    }
+
+    int right() const {
+        return (rank + 1) % ranks;
+    }
+
+    // Send to one neighbour and receive from the other, sizes first.
+    // The tag tells the two directions apart when both neighbours are one rank.
+    template <typename T>
+    void shift(const std::vector<T>& out, int to, std::vector<T>& in, int from, int tag) {
+        int sendCount = out.size() * sizeof(T), recvCount = 0;
+        MPI_Sendrecv(&sendCount, 1, MPI_INT, to, tag, &recvCount, 1, MPI_INT, from, tag,
+                     comm, MPI_STATUS_IGNORE);
+        in.resize(recvCount / sizeof(T));
+        MPI_Sendrecv(out.data(), sendCount, MPI_BYTE, to, tag + 1, in.data(), recvCount, MPI_BYTE, from, tag + 1,
+                     comm, MPI_STATUS_IGNORE);
+    }
+
+    void exchangeHalo() {
+        const float radius = params.interactionRadius;
+        const float width = params.width;
+        std::vector<HaloParticle> toLeft, toRight, fromLeft, fromRight;
+        for (size_t i = 0; i < posX.size(); i++) {
+            // Shift into the receiver's frame across the periodic boundary
+            if (posX[i] < x0 + radius) {
+                toLeft.push_back({rank == 0 ? posX[i] + width : posX[i], posY[i], velX[i], velY[i]});
+            }
+            if (posX[i] >= x1 - radius) {
+                toRight.push_back({rank == ranks - 1 ? posX[i] - width : posX[i], posY[i], velX[i], velY[i]});
+            }
+        }
+        shift(toLeft, left(), fromRight, right(), 0);
+        shift(toRight, right(), fromLeft, left(), 2);
+
+        haloX.clear();
+        haloY.clear();
+        haloVelX.clear();
+        haloVelY.clear();
+        for (const std::vector<HaloParticle>* from : {&fromLeft, &fromRight}) {
+            for (const HaloParticle& p : *from) {
+                haloX.push_back(p.x);
+                haloY.push_back(p.y);
+                haloVelX.push_back(p.velX);
+                haloVelY.push_back(p.velY);
+            }
+        }
+        haloCount = haloX.size();
+    }
+
+    // Hand particles that left the slab to the neighbour that now owns them
+    void migrate() {
+        std::vector<Migrant> toLeft, toRight, fromLeft, fromRight;
+        size_t kept = 0;
+        for (size_t i = 0; i < posX.size(); i++) {
+            int owner = ownerOf(posX[i]);
+            if (owner == rank) {
+                posX[kept] = posX[i];
+                posY[kept] = posY[i];
+                velX[kept] = velX[i];
+                velY[kept] = velY[i];
+                angles[kept] = angles[i];
+                ids[kept] = ids[i];
+                kept++;
+                continue;
+            }
+            // A particle moves less than a slab per step, so the new owner
+            // is one of the neighbours
+            Migrant m = {posX[i], posY[i], velX[i], velY[i], angles[i], ids[i]};
+            (owner == left() ? toLeft : toRight).push_back(m);
+        }
+        migrated = posX.size() - kept;
+        posX.resize(kept);
+        posY.resize(kept);
+        velX.resize(kept);
+        velY.resize(kept);
+        angles.resize(kept);
+        ids.resize(kept);
+
+        shift(toLeft, left(), fromRight, right(), 4);
+        shift(toRight, right(), fromLeft, left(), 6);
+        for (const std::vector<Migrant>* from : {&fromLeft, &fromRight}) {
+            for (const Migrant& m : *from) {
+                posX.push_back(m.x);
+                posY.push_back(m.y);
+                velX.push_back(m.velX);
+                velY.push_back(m.velY);
+                angles.push_back(m.angle);
+                ids.push_back(m.id);
+            }
+        }
+    }
+};
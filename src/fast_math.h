@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+
+// Polynomial sin/cos and atan2 for the fast heading update. They are written
+// without branches (selects only) so loops calling them auto-vectorize.
+// Coefficients are the single precision minimax fits from Cephes; the real
+// error bound is measured against libm by fastMathMaxError().
+
+
+// sin and cos of a together, accurate to a few ulp for |a| up to ~1e4
+inline void fastSinCos(float a, float& s, float& c) {
+    // Reduce to r in [-pi/4, pi/4] and quadrant q, with pi/2 split in three
+    // parts (Cody-Waite) so the reduction is exact for moderate q
+    float scaled = a * 0.636619772f;
+    float q = float(int(scaled + (scaled < 0 ? -0.5f : 0.5f)));
+    float r = a - q * 1.5703125f;
+    r = r - q * 4.83751296997e-4f;
+    r = r - q * 7.54978995489e-8f;
+    float z = r * r;
+
+    float sinR = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * r + r;
+    float cosR = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z
+                 - 0.5f * z + 1.0f;
+
+    int quadrant = int(q) & 3;
+    float sinOut = (quadrant & 1) ? cosR : sinR;
+    float cosOut = (quadrant & 1) ? sinR : cosR;
+    s = (quadrant & 2) ? -sinOut : sinOut;
+    c = ((quadrant + 1) & 2) ? -cosOut : cosOut;
+}
+
+
+// atan2(y, x) in [-pi, pi], returns 0 for (0, 0) like std::atan2
+inline float fastAtan2(float y, float x) {
+    const float pi = 3.14159265f;
+    float ax = std::fabs(x);
+    float ay = std::fabs(y);
+    float hi = std::max(ax, ay);
+    float lo = std::min(ax, ay);
+    float t = lo / std::max(hi, 1e-30f);   // in [0, 1], 0 for (0, 0)
+
+    // atan(t) = pi/4 + atan((t-1)/(t+1)) brings t above tan(pi/8) into range.
+    // Both divisions are done unconditionally so the select stays branch-free.
+    bool shifted = t > 0.414213562f;
+    float tShifted = (t - 1.0f) / (t + 1.0f);
+    float u = shifted ? tShifted : t;
+    float z = u * u;
+    float r = (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z
+               - 3.33329491539e-1f) * z * u + u;
+    r = shifted ? r + pi/4 : r;
+
+    r = ay > ax ? pi/2 - r : r;
+    r = x < 0 ? pi - r : r;
+    return y < 0 ? -r : r;
+}
+
+
+// Natural log of x > 0 (normal floats only), to about 1e-7 relative.
+// Splits x into m 2^e with m in [sqrt(1/2), sqrt(2)) by bit operations.
+inline float fastLog(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, 4);
+    int e = int((bits >> 23) & 0xff) - 126;
+    bits = (bits & 0x807fffffu) | 0x3f000000u;      // m in [0.5, 1)
+    float m;
+    memcpy(&m, &bits, 4);
+    bool low = m < 0.707106781f;
+    e = low ? e - 1 : e;
+    m = low ? m + m - 1.0f : m - 1.0f;
+    float z = m * m;
+
+    float y = ((((((((7.0376836292e-2f * m - 1.1514610310e-1f) * m + 1.1676998740e-1f) * m
+                    - 1.2420140846e-1f) * m + 1.4249322787e-1f) * m - 1.6668057665e-1f) * m
+                 + 2.0000714765e-1f) * m - 2.4999993993e-1f) * m + 3.3333331174e-1f) * m * z;
+    float fe = float(e);
+    y += -2.12194440e-4f * fe;
+    y += -0.5f * z;
+    return m + y + 0.693359375f * fe;
+}
+
+
+// Largest absolute error (radians / unit) of the fast functions against
+// libm, measured on a dense grid over the range used by the update step
+struct FastMathError {
+    float sinCos;
+    float atan2;
+};
+
+inline FastMathError fastMathMaxError() {
+    FastMathError err = {0, 0};
+    const int samples = 1 << 16;
+    for (int i = 0; i <= samples; i++) {
+        // Noise angles are at most pi in magnitude; test twice that
+        float a = -6.2831853f + 12.566370f * i / samples;
+        float s, c;
+        fastSinCos(a, s, c);
+        err.sinCos = std::max(err.sinCos, float(std::fabs(s - std::sin(double(a)))));
+        err.sinCos = std::max(err.sinCos, float(std::fabs(c - std::cos(double(a)))));
+
+        float theta = -3.14159265f + 6.2831853f * i / samples;
+        float x = std::cos(theta), y = std::sin(theta);
+        float exact = std::atan2(double(y), double(x));
+        err.atan2 = std::max(err.atan2, float(std::fabs(fastAtan2(y, x) - exact)));
+    }
+    return err;
+}
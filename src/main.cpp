@@ -7,7 +7,25 @@
 #include <random>
 #include <vector>
 #include <algorithm>
-
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "checkpoint.h"
+#include "compact.h"
+#include "raster.h"
+#include "simulation.h"
+#include "sweep.h"
+#include "swarm.h"
+#include "trajectory.h"
+#include "validate.h"
+#include "video.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 // SDL2 framework class
@@ -16,9 +34,12 @@ public:
     // Contructor which initialize the parameters.
     SDL_Renderer *renderer = NULL;      // Pointer for the renderer
     SDL_Window *window = NULL;
+    SDL_Texture *texture = NULL;        // Streaming texture the frame is uploaded to
     Framework(int height_, int width_): height(height_), width(width_){
         SDL_Init(SDL_INIT_VIDEO);       // Initializing SDL as Video
         SDL_CreateWindowAndRenderer(width, height, 0, &window, &renderer);
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                    SDL_TEXTUREACCESS_STREAMING, width, height);
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);      // setting draw color
         SDL_RenderClear(renderer);      // Clear the newly created window
         SDL_RenderPresent(renderer);    // Reflects the changes done in the
@@ -26,8 +47,15 @@ public:
                                         //  window.
     }
 
+    // Copy a width x height ARGB frame to the window in one upload
+    void show(const uint32_t *pixels){
+        SDL_UpdateTexture(texture, NULL, pixels, width * sizeof(uint32_t));
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
+    }
+
     // Destructor
     ~Framework(){
+        SDL_DestroyTexture(texture);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
@@ -41,338 +69,535 @@ private:
 
 
 
-void draw_pixel_white(SDL_Renderer *renderer,int x, int y){
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    SDL_RenderDrawPoint(renderer, x, y);
+void printUsage(const char* prog){
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --headless          run without opening a window\n"
+              << "  --n <int>           number of particles\n"
+              << "  --noise <float>     noise amplitude\n"
+              << "  --noise-dist <name> uniform (default, width = noise) or gaussian (wrapped, sigma = noise)\n"
+              << "  --radius <float>    interaction radius\n"
+              << "  --verlet <float>    reuse neighbour lists of radius + this skin over several steps (cells engine)\n"
+              << "  --topological <int> align with the k nearest particles instead of those within the radius\n"
+              << "  --velocity <float>  particle speed\n"
+              << "  --width <float>     box width\n"
+              << "  --height <float>    box height\n"
+              << "  --depth <float>     box depth, with --dimensions 3\n"
+              << "  --dimensions <int>  2 (default) or 3, 3D runs headless (--observe only)\n"
+              << "  --steps <int>       number of steps (0 = until 'q', headless default 1000)\n"
+              << "  --seed <int>        seed for the random generator\n"
+              << "  --threads <int>     number of OpenMP threads (default: all cores)\n"
+              << "  --engine <name>     neighbour search: cells (default), quadtree, flat-quadtree, brute-force\n"
+              << "  --reorder <int>     sort particles along a Z-order curve every K steps\n"
+              << "  --simd <level>      neighbour kernel: auto (default), scalar, avx2, avx512\n"
+              << "  --fast-math         polynomial sincos/atan2 heading update instead of libm\n"
+              << "  --compact           16-bit positions and headings, for huge headless runs (--observe only)\n"
+              << "  --trajectory <file> write positions and angles to a binary trajectory file\n"
+              << "  --trajectory-every <int>  steps between trajectory frames (default 1)\n"
+              << "  --observe <int>     log polar order, mean heading and neighbours every K steps\n"
+              << "  --observe-file <file>  write the observables log to a file instead of stdout\n"
+              << "  --checkpoint <file> save the full state to this file (atomically replaced)\n"
+              << "  --checkpoint-every <int>  steps between checkpoints (default: end of headless run)\n"
+              << "  --restart <file>    resume bit-exactly from a checkpoint, --steps more steps\n"
+              << "  --window <int>      longest window side in pixels (default: box size)\n"
+              << "  --render-every <int>  publish a frame to the window every K steps (default 1)\n"
+              << "  --dot-radius <int>  draw particles as discs of this radius in pixels (default 0, one pixel)\n"
+              << "  --headings          draw a heading line coloured by angle for each particle\n"
+              << "  --export <file>     write a movie: .y4m, .gif, or a PPM per frame for a name with %d\n"
+              << "  --export-every <int>  steps between movie frames (default 1)\n"
+              << "  --fps <int>         frame rate stored in the movie (default 30)\n"
+              << "  --profile           time every phase of the main loop, 'p' toggles it in the window\n"
+              << "  --profile-out <file>  per-frame timings and counters, .json for JSON, otherwise CSV\n"
+              << "Parameter sweep (headless, one row of time-averaged observables per point):\n"
+              << "  --sweep             run the grid below instead of a single simulation\n"
+              << "  --sweep-noise <list>    noise values, \"a,b,c\" or \"start:stop:step\"\n"
+              << "  --sweep-density <list>  particles per unit area in the --width x --height box\n"
+              << "  --sweep-radius <list>   interaction radii\n"
+              << "  --replicas <int>    seeds per point (default 1)\n"
+              << "  --burn-in <int>     steps before measuring, then --steps are averaged\n"
+              << "  --workers <int>     replicas run at once (default: all cores)\n"
+              << "  --sweep-out <file>  results table (CSV), default stdout\n"
+              << "Validation (headless, engines against the brute-force search from the same state and noise):\n"
+              << "  --validate <list>   engines to check: quadtree, flat-quadtree, cells, fast-math, compact\n"
+              << "  --validate-out <file>  per-particle neighbour-set and heading mismatches (CSV)\n"
+              << "  --validate-tolerance <float>  heading error counted as a mismatch (default 1e-3 rad)\n";
 }
 
 
-//When drawing square, use -1 on both positions and -2 on width for grid net
-void draw_circle_white(SDL_Renderer *renderer,int center_x, int center_y, int radius_){
-    // Setting the color to be RED with 100% opaque (0% trasparent).
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    // Drawing square
-    for(int x=center_x-radius_; x<=center_x+radius_; x++)
-    {
-        for(int y=center_y-radius_; y<=center_y+radius_; y++)
-        {
-            if ((std::pow(center_x-x,2) +  std::pow(center_y-y,2)) <= std::pow(radius_,2) )
-            {
-                    SDL_RenderDrawPoint(renderer, x, y);
+// Read command-line flags into params, returns false on unknown or incomplete flags
+bool parseArgs(int argc, char * argv[], Params &params, SweepParams &sweep, ValidateParams &validate){
+    for (int i = 1; i<argc; i++){
+        const char* arg = argv[i];
+        const char* value = (i+1 < argc) ? argv[i+1] : nullptr;
+        if (std::strcmp(arg, "--help") == 0) {
+            return false;
+        }
+        if (std::strcmp(arg, "--headless") == 0) {
+            params.headless = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--fast-math") == 0) {
+            params.fastMath = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--compact") == 0) {
+            params.compact = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--sweep") == 0) {
+            sweep.enabled = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--headings") == 0) {
+            params.drawHeadings = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--profile") == 0) {
+            params.profile = true;
+            continue;
+        }
+        if (value == nullptr) {
+            std::cerr << "Missing value or unknown flag: " << arg << "\n";
+            return false;
+        }
+        if (std::strcmp(arg, "--n") == 0) {
+            params.nParticles = std::atoi(value);
+        } else if (std::strcmp(arg, "--noise") == 0) {
+            params.noise = std::atof(value);
+        } else if (std::strcmp(arg, "--noise-dist") == 0) {
+            if (std::strcmp(value, "uniform") == 0) {
+                params.noiseDistribution = NoiseDistribution::Uniform;
+            } else if (std::strcmp(value, "gaussian") == 0) {
+                params.noiseDistribution = NoiseDistribution::Gaussian;
+            } else {
+                std::cerr << "Unknown noise distribution: " << value << "\n";
+                return false;
+            }
+        } else if (std::strcmp(arg, "--radius") == 0) {
+            params.interactionRadius = std::atof(value);
+        } else if (std::strcmp(arg, "--verlet") == 0) {
+            params.skin = std::atof(value);
+        } else if (std::strcmp(arg, "--topological") == 0) {
+            params.topological = std::atoi(value);
+        } else if (std::strcmp(arg, "--velocity") == 0) {
+            params.velocity = std::atof(value);
+        } else if (std::strcmp(arg, "--width") == 0) {
+            params.width = std::atof(value);
+        } else if (std::strcmp(arg, "--height") == 0) {
+            params.height = std::atof(value);
+        } else if (std::strcmp(arg, "--depth") == 0) {
+            params.depth = std::atof(value);
+        } else if (std::strcmp(arg, "--dimensions") == 0) {
+            params.dimensions = std::atoi(value);
+        } else if (std::strcmp(arg, "--steps") == 0) {
+            params.steps = std::atol(value);
+        } else if (std::strcmp(arg, "--seed") == 0) {
+            params.seed = std::strtoul(value, nullptr, 10);
+            params.randomSeed = false;
+        } else if (std::strcmp(arg, "--engine") == 0) {
+            if (std::strcmp(value, "cells") == 0) {
+                params.engine = Engine::CellList;
+            } else if (std::strcmp(value, "quadtree") == 0) {
+                params.engine = Engine::Quadtree;
+            } else if (std::strcmp(value, "flat-quadtree") == 0) {
+                params.engine = Engine::FlatQuadtree;
+            } else if (std::strcmp(value, "brute-force") == 0) {
+                params.engine = Engine::BruteForce;
+            } else {
+                std::cerr << "Unknown engine: " << value << "\n";
+                return false;
+            }
+        } else if (std::strcmp(arg, "--reorder") == 0) {
+            params.reorderEvery = std::atoi(value);
+        } else if (std::strcmp(arg, "--simd") == 0) {
+            if (std::strcmp(value, "auto") == 0) {
+                setNeighborKernel(SimdLevel::Auto);
+            } else if (std::strcmp(value, "scalar") == 0) {
+                setNeighborKernel(SimdLevel::Scalar);
+            } else if (std::strcmp(value, "avx2") == 0) {
+                setNeighborKernel(SimdLevel::AVX2);
+            } else if (std::strcmp(value, "avx512") == 0) {
+                setNeighborKernel(SimdLevel::AVX512);
+            } else {
+                std::cerr << "Unknown SIMD level: " << value << "\n";
+                return false;
+            }
+        } else if (std::strcmp(arg, "--trajectory") == 0) {
+            params.trajectoryPath = value;
+        } else if (std::strcmp(arg, "--trajectory-every") == 0) {
+            params.trajectoryEvery = std::atoi(value);
+        } else if (std::strcmp(arg, "--observe") == 0) {
+            params.observeEvery = std::atoi(value);
+        } else if (std::strcmp(arg, "--observe-file") == 0) {
+            params.observePath = value;
+        } else if (std::strcmp(arg, "--sweep-noise") == 0 || std::strcmp(arg, "--sweep-density") == 0 ||
+                   std::strcmp(arg, "--sweep-radius") == 0) {
+            std::vector<float> &list = std::strcmp(arg, "--sweep-noise") == 0 ? sweep.noise :
+                                       std::strcmp(arg, "--sweep-density") == 0 ? sweep.density : sweep.radius;
+            if (!parseList(value, list)) {
+                std::cerr << "Bad list for " << arg << ": " << value << "\n";
+                return false;
+            }
+        } else if (std::strcmp(arg, "--replicas") == 0) {
+            sweep.replicas = std::atoi(value);
+        } else if (std::strcmp(arg, "--burn-in") == 0) {
+            sweep.burnIn = std::atol(value);
+        } else if (std::strcmp(arg, "--workers") == 0) {
+            sweep.workers = std::atoi(value);
+        } else if (std::strcmp(arg, "--sweep-out") == 0) {
+            sweep.outputPath = value;
+        } else if (std::strcmp(arg, "--validate") == 0) {
+            validate.engines.clear();
+            std::string list = value;
+            for (size_t start = 0; start <= list.size();) {
+                size_t end = std::min(list.find(',', start), list.size());
+                std::string name = list.substr(start, end - start);
+                if (!validationEngine(name)) {
+                    std::cerr << "Cannot validate engine: " << name << "\n";
+                    return false;
                 }
+                validate.engines.push_back(name);
+                start = end + 1;
+            }
+        } else if (std::strcmp(arg, "--validate-out") == 0) {
+            validate.outputPath = value;
+        } else if (std::strcmp(arg, "--validate-tolerance") == 0) {
+            validate.tolerance = std::atof(value);
+        } else if (std::strcmp(arg, "--checkpoint") == 0) {
+            params.checkpointPath = value;
+        } else if (std::strcmp(arg, "--checkpoint-every") == 0) {
+            params.checkpointEvery = std::atoi(value);
+        } else if (std::strcmp(arg, "--restart") == 0) {
+            params.restartPath = value;
+        } else if (std::strcmp(arg, "--window") == 0) {
+            params.windowSize = std::atoi(value);
+        } else if (std::strcmp(arg, "--export") == 0) {
+            params.exportPath = value;
+        } else if (std::strcmp(arg, "--export-every") == 0) {
+            params.exportEvery = std::atoi(value);
+        } else if (std::strcmp(arg, "--fps") == 0) {
+            params.exportFps = std::atoi(value);
+        } else if (std::strcmp(arg, "--render-every") == 0) {
+            params.renderEvery = std::atoi(value);
+        } else if (std::strcmp(arg, "--dot-radius") == 0) {
+            params.dotRadius = std::atoi(value);
+        } else if (std::strcmp(arg, "--profile-out") == 0) {
+            params.profilePath = value;
+            params.profile = true;
+        } else if (std::strcmp(arg, "--threads") == 0) {
+#ifdef _OPENMP
+            omp_set_num_threads(std::atoi(value));
+#endif
+        } else {
+            std::cerr << "Unknown flag: " << arg << "\n";
+            return false;
         }
+        i++;
+    }
+    if (params.nParticles <= 0 || params.width <= 0 || params.height <= 0 ||
+        params.interactionRadius <= 0 || params.steps < 0 || params.trajectoryEvery <= 0 ||
+        params.observeEvery < 0 || params.checkpointEvery < 0 || params.windowSize < 0 || params.dotRadius < 0 ||
+        params.renderEvery <= 0 || params.exportEvery <= 0 || params.exportFps <= 0 || sweep.replicas <= 0 || sweep.burnIn < 0) {
+        std::cerr << "Particle count, box size, radius and output intervals must be positive\n";
+        return false;
+    }
+    if (params.topological < 0 || params.topological > maxTopological) {
+        std::cerr << "--topological takes k from 1 to " << maxTopological << "\n";
+        return false;
+    }
+    if (params.topological > 0 && (params.engine != Engine::CellList || params.compact || params.dimensions != 2)) {
+        std::cerr << "--topological needs the cells engine\n";
+        return false;
+    }
+    if (params.skin > 0 && (params.compact || params.dimensions != 2)) {
+        std::cerr << "--verlet is not supported with --compact or --dimensions 3\n";
+        return false;
+    }
+    // A restart takes the physics from the checkpoint and is checked then
+    const char* conflict = params.restartPath.empty() ? verletConflict(params) : NULL;
+    if (conflict) {
+        std::cerr << "--" << conflict << "\n";
+        return false;
+    }
+    if (params.dimensions != 2 && params.dimensions != 3) {
+        std::cerr << "--dimensions must be 2 or 3\n";
+        return false;
+    }
+    if (params.dimensions == 3 && (params.depth <= 0 || params.compact || !params.headless ||
+                                   params.noiseDistribution != NoiseDistribution::Uniform ||
+                                   !params.trajectoryPath.empty() || !params.checkpointPath.empty() ||
+                                   !params.restartPath.empty() || !params.exportPath.empty() || sweep.enabled)) {
+        std::cerr << "--dimensions 3 runs headless, with uniform noise, and only supports --observe\n";
+        return false;
+    }
+    if (!validate.engines.empty() && (params.topological > 0 || params.skin > 0 || params.compact ||
+                                      params.dimensions != 2 || sweep.enabled || !params.restartPath.empty())) {
+        std::cerr << "--validate checks the metric rule in 2D from a fresh start\n";
+        return false;
+    }
+    if (params.compact && (!params.headless || !params.trajectoryPath.empty() || !params.checkpointPath.empty() ||
+                           !params.restartPath.empty() || !params.exportPath.empty() || sweep.enabled)) {
+        std::cerr << "--compact runs headless and only supports --observe\n";
+        return false;
     }
+    if (params.compact && (params.engine != Engine::CellList || params.fastMath || params.reorderEvery > 0)) {
+        std::cerr << "--compact has its own search, heading update and cell order;"
+                  << " --engine, --fast-math and --reorder do not apply\n";
+        return false;
+    }
+    if (sweep.enabled && (!params.trajectoryPath.empty() || !params.checkpointPath.empty() ||
+                          !params.restartPath.empty() || !params.exportPath.empty() ||
+                          params.profile || params.observeEvery > 0)) {
+        std::cerr << "--sweep only writes its table (--sweep-out); --trajectory, --checkpoint,"
+                  << " --restart, --export, --profile and --observe do not apply\n";
+        return false;
+    }
+    return true;
 }
 
-// Define a struct for points
-struct Point {
-    float x, y;
-    int index; // Original index in the arrays for reference
-};
 
-// Define a class for the Quadtree
-class Quadtree {
-public:
-    // Define the boundary of the quadtree
-    struct Boundary {
-        float x, y; // Center of the boundary
-        float halfWidth, halfHeight; // Half-dimensions
-    } boundary;
-
-    int capacity; // Maximum points in a node before subdivision
-    std::vector<Point> points; // Points stored in this node
-    bool divided = false; // Whether this node is subdivided
-    Quadtree* northwest = nullptr;
-    Quadtree* northeast = nullptr;
-    Quadtree* southwest = nullptr;
-    Quadtree* southeast = nullptr;
-
-    // Constructor
-    Quadtree(Boundary boundary, int capacity)
-        : boundary(boundary), capacity(capacity) {}
-
-    ~Quadtree() {
-        delete northwest;
-        delete northeast;
-        delete southwest;
-        delete southeast;
-    }
-
-    // Insert a point into the Quadtree
-    bool insert(const Point& point) {
-        // Check if the point is within the boundary
-        if (!contains(point)) return false;
-
-        // If there's space, add the point
-        if (points.size() < capacity) {
-            points.push_back(point);
-            return true;
-        }
+// Drawing options from the command line
+RenderStyle renderStyle(const Params &params){
+    RenderStyle style;
+    style.dotRadius = params.dotRadius;
+    style.headings = params.drawHeadings;
+    return style;
+}
 
-        // Otherwise, subdivide if necessary
-        if (!divided) subdivide();
 
-        // Insert into the appropriate quadrant
-        return northwest->insert(point) || northeast->insert(point) ||
-               southwest->insert(point) || southeast->insert(point);
+// Size of the drawn frame: the box in pixels, scaled so its longest side is
+// --window pixels when that is given
+void frameSize(const Params &params, int &width, int &height){
+    width = params.width;
+    height = params.height;
+    if (params.windowSize > 0) {
+        float scale = params.windowSize / std::max(params.width, params.height);
+        width = std::max(1, int(params.width * scale));
+        height = std::max(1, int(params.height * scale));
     }
+}
 
-    // Query points within a radius
-    void query(float x, float y, float radius, std::vector<int>& found) const {
-        // Check if the search area intersects this boundary
-        if (!intersects(x, y, radius)) return;
 
-        // Check points in this node
-        for (const auto& point : points) {
-            float dx = x - point.x;
-            float dy = y - point.y;
-            if (dx * dx + dy * dy <= radius * radius) {
-                found.push_back(point.index);
+// Everything written while the simulation runs, called after every step
+class Outputs {
+public:
+    bool open(Simulation &sim){
+        const Params &params = sim.params;
+        startIteration = sim.iteration;
+        if (!params.trajectoryPath.empty()) {
+            if (!trajectory.open(params.trajectoryPath, params, params.trajectoryEvery)) return false;
+        }
+        if (params.observeEvery > 0) {
+            if (!params.observePath.empty()) {
+                observeFile.open(params.observePath);
+                if (!observeFile) {
+                    std::cerr << "Could not open observables file " << params.observePath << "\n";
+                    return false;
+                }
             }
+            observeLog() << "# step polar_order mean_heading mean_neighbors\n";
         }
-
-        // Query children if divided
-        if (divided) {
-            northwest->query(x, y, radius, found);
-            northeast->query(x, y, radius, found);
-            southwest->query(x, y, radius, found);
-            southeast->query(x, y, radius, found);
+        if (!params.profilePath.empty()) {
+            profileFile.open(params.profilePath);
+            if (!profileFile) {
+                std::cerr << "Could not open profile file " << params.profilePath << "\n";
+                return false;
+            }
+            size_t dot = params.profilePath.rfind('.');
+            profileJson = dot != std::string::npos && params.profilePath.substr(dot) == ".json";
+            writeProfileHeader(profileFile, profileJson);
+        }
+        if (!params.exportPath.empty()) {
+            int width, height;
+            frameSize(params, width, height);
+            exportRaster.resize(width, height);
+            if (!video.open(params.exportPath, width, height, params.exportFps)) return false;
         }
+        record(sim);
+        return true;
     }
 
-private:
-    // Check if a point is within the boundary
-    bool contains(const Point& point) const {
-        return point.x >= boundary.x - boundary.halfWidth &&
-               point.x < boundary.x + boundary.halfWidth &&
-               point.y >= boundary.y - boundary.halfHeight &&
-               point.y < boundary.y + boundary.halfHeight;
+    ~Outputs(){
+        if (profileFile.is_open()) {
+            writeProfileFooter(profileFile, profileJson);
+        }
     }
 
-    // Check if a circle intersects the boundary
-    bool intersects(float x, float y, float radius) const {
-        float dx = std::max(std::abs(x - boundary.x) - boundary.halfWidth, 0.0f);
-        float dy = std::max(std::abs(y - boundary.y) - boundary.halfHeight, 0.0f);
-        return (dx * dx + dy * dy) <= radius * radius;
+    void record(Simulation &sim){
+        const Params &params = sim.params;
+        if (trajectory.isOpen() && sim.iteration % params.trajectoryEvery == 0) {
+            trajectory.submit(sim);
+        }
+        // Observables are measured by the step, so there is nothing to log before the first one
+        if (params.observeEvery > 0 && sim.iteration > startIteration && sim.iteration % params.observeEvery == 0) {
+            const Observables &obs = sim.observables;
+            observeLog() << obs.step << " " << obs.polarOrder << " "
+                         << obs.meanHeading << " " << obs.meanNeighbors << "\n";
+        }
+        if (!params.checkpointPath.empty() && params.checkpointEvery > 0 &&
+            sim.iteration > startIteration && sim.iteration % params.checkpointEvery == 0) {
+            saveCheckpoint(sim, params.checkpointPath);
+        }
+        if (video.isOpen() && sim.iteration % params.exportEvery == 0) {
+            exportRaster.draw(sim.posX.data(), sim.posY.data(), sim.angles.data(), params.nParticles,
+                              params.width, params.height, renderStyle(params));
+            video.submit(exportRaster.pixels);
+        }
     }
 
-    // Subdivide the Quadtree into four quadrants
-    void subdivide() {
-        float hw = boundary.halfWidth / 2.0f;
-        float hh = boundary.halfHeight / 2.0f;
-
-        northwest = new Quadtree({boundary.x - hw, boundary.y - hh, hw, hh}, capacity);
-        northeast = new Quadtree({boundary.x + hw, boundary.y - hh, hw, hh}, capacity);
-        southwest = new Quadtree({boundary.x - hw, boundary.y + hh, hw, hh}, capacity);
-        southeast = new Quadtree({boundary.x + hw, boundary.y + hh, hw, hh}, capacity);
+    // Close the profiled frame and log it
+    void recordProfile(Profiler &profiler){
+        if (!profiler.enabled) return;
+        profiler.endFrame();
+        if (profileFile.is_open()) {
+            writeProfileFrame(profileFile, profileJson, profiledFrames == 0, profiler.frame);
+            profiledFrames++;
+        }
+    }
 
-        divided = true;
+private:
+    long startIteration = 0;
+    TrajectoryWriter trajectory;
+    std::ofstream observeFile;
+    std::ofstream profileFile;
+    Rasterizer exportRaster;
+    VideoWriter video;
+    bool profileJson = false;
+    long profiledFrames = 0;
+
+    std::ostream &observeLog(){
+        if (observeFile.is_open()) return observeFile;
+        return std::cout;
     }
 };
 
 
+// Batch mode for render-less machines, no SDL function is called here
+int runHeadless(Simulation &sim){
+    const Params &params = sim.params;
+    long steps = params.steps > 0 ? params.steps : 1000;
+
+    Outputs outputs;
+    if (!outputs.open(sim)) return 1;
+
+    auto start = std::chrono::steady_clock::now();
+    for (long s = 0; s<steps; s++){
+        sim.profiler.beginFrame(sim.iteration + 1);
+        sim.step();
+        {
+            ScopedTimer timer(sim.profiler, Phase::Output);
+            outputs.record(sim);
+        }
+        outputs.recordProfile(sim.profiler);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(stop - start).count();
 
-// Add copies of particles outside of bound so that a particle close to an edge
-// can interact with a particle on the opposite side of the periodic boundary
-void fillPadding(std::vector<float> &posXPad, std::vector<float> &posYPad, 
-                 std::vector<float> &anglePad, float x_pos, float y_pos, float angle, 
-                 float xMax, float yMax, float interactionRadius) {
-
-    // Check for boundary interactions and add padded particles
-    if (x_pos + interactionRadius > xMax) {
-        posXPad.push_back(x_pos - xMax); // Wrap around X (right to left)
-        posYPad.push_back(y_pos);        // Same Y
-        anglePad.push_back(angle);
-    } else if (x_pos - interactionRadius < 0) {
-        posXPad.push_back(x_pos + xMax); // Wrap around X (left to right)
-        posYPad.push_back(y_pos);        // Same Y
-        anglePad.push_back(angle);
-    } 
-    if (y_pos + interactionRadius > yMax) {
-        posXPad.push_back(x_pos);        // Same X
-        posYPad.push_back(y_pos); // Wrap around Y (top to bottom)
-        anglePad.push_back(angle);
-    } else if (y_pos - interactionRadius < 0) {
-        posXPad.push_back(x_pos);        // Same X
-        posYPad.push_back(y_pos + yMax); // Wrap around Y (bottom to top)
-        anglePad.push_back(angle);
+    if (!params.checkpointPath.empty() && !saveCheckpoint(sim, params.checkpointPath)) {
+        return 1;
     }
+
+    std::cout << "particles " << params.nParticles
+              << " steps " << steps
+              << " seed " << params.seed
+              << " kernel " << neighborKernelName()
+              << " time " << seconds << " s"
+              << " (" << steps/seconds << " steps/s)\n";
+    sim.profiler.printSummary(std::cout, "step");
+    return 0;
 }
 
 
-int main(int argc, char * argv[]){
-    // Creating the object by passing Height and Width value.
-    // Physics variables
-    float height = 900;
-    float width = 900;
-    float radius = 2;
-    float velocity = 2;
-    int nParticles = 7000;
-
-    // Variables affecting behaviour
-    float noise = 0.7;
-    float interactionRadius = 10;
-    float inRadiusSquared = interactionRadius*interactionRadius;
+// Window mode. The simulation runs uncapped on its own thread and publishes
+// a snapshot every --render-every steps; this thread owns SDL and draws the
+// newest snapshot, so drawing and vsync never hold up the physics.
+int runWindow(Simulation &sim){
+    const Params &params = sim.params;
+    Outputs outputs;
+    if (!outputs.open(sim)) return 1;
 
     //Create graphic window
-    Framework fw(height, width);
+    int windowWidth, windowHeight;
+    frameSize(params, windowWidth, windowHeight);
+    Framework fw(windowHeight, windowWidth);
     SDL_Event event;
 
-    // Generator for random numbers
-    std::random_device                  rand_dev;
-    std::mt19937                        generator(rand_dev());
-
-    std::uniform_real_distribution<float>  xRand(radius*2, width-radius*2);
-    std::uniform_real_distribution<float>  wRand(-0.5, 0.5);
-    float pi = 3.14159;
-    std::uniform_real_distribution<float>  thetaRand(-pi, pi);
-
-
-    // Init our swarm arrays
-    std::vector<float> posX(nParticles);
-    std::vector<float> posY(nParticles);
-    std::vector<float> velX(nParticles);
-    std::vector<float> velY(nParticles);
-    std::vector<float> angles(nParticles);
-
-    for (int i = 0; i<nParticles; i++){
-        posX[i] = xRand(generator);
-        posY[i] = xRand(generator); // Depending on screen size Y might have to be scaled
-        angles[i] = thetaRand(generator);
-        velX[i]=velocity*std::cos(angles[i]);
-        velY[i]=velocity*std::sin(angles[i]);
-    }
-
-    // Attributes of updated particles
-    std::vector<float> newPosX(nParticles);
-    std::vector<float> newPosY(nParticles);
-    std::vector<float> newVelX(nParticles);
-    std::vector<float> newVelY(nParticles);
-    std::vector<float> newAngles(nParticles);
-
-    // Padding (for interactions thorugh boundary)
-    std::vector<float> posXPad, posYPad, anglePad;
-
-    // Main loop start here stops when key 'q' is pressed
+    Rasterizer raster;
+    raster.resize(windowWidth, windowHeight);
+    RenderStyle style = renderStyle(params);
+
+    LatestSnapshot latest;
+    latest.publish(sim);
+    const long startIteration = sim.iteration;     // --steps counts from a restart
+    std::atomic<bool> stop(false), finished(false), toggleProfile(false);
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    std::thread simulation([&]{
+#ifdef _OPENMP
+        omp_set_num_threads(threads);     // --threads was only applied to the main thread
+#endif
+        while (!stop && (params.steps == 0 || sim.iteration - startIteration < params.steps)) {
+            if (toggleProfile.exchange(false)) {
+                sim.profiler.enabled = !sim.profiler.enabled;
+            }
+            sim.profiler.beginFrame(sim.iteration + 1);
+            sim.step();
+            {
+                ScopedTimer timer(sim.profiler, Phase::Output);
+                outputs.record(sim);
+            }
+            outputs.recordProfile(sim.profiler);
+            if (sim.iteration % params.renderEvery == 0) {
+                latest.publish(sim);
+            }
+        }
+        latest.publish(sim);              // Always show the final state
+        finished = true;
+    });
+
+    // Main loop start here stops when key 'q' is pressed, or after --steps
+    // once the last snapshot is on screen
+    Profiler renderProfiler;
+    renderProfiler.enabled = params.profile;
     const Uint8* state = SDL_GetKeyboardState(nullptr);
-    int iteration = 0;
-    while (!state[SDL_SCANCODE_Q]) //&& iteration<10)
+    bool profileKeyDown = false;
+    while (!state[SDL_SCANCODE_Q])
     {
-        SDL_SetRenderDrawColor(fw.renderer, 0, 0, 0, 255);
-        SDL_RenderClear(fw.renderer);
-
-        float x_pos = 0; // Maybe excessive amount of help variables?
-        float y_pos = 0;
-        float angle = 0;
-        for (int i = 0; i<nParticles; i++){
-            x_pos = posX[i]; 
-            y_pos = posY[i];
-            angle = angles[i];
-
-            newPosX[i] = x_pos; // This should be vectorized
-            newPosY[i] = y_pos;
-            newVelY[i] = velY[i];
-            newVelX[i] = velX[i];
-            newAngles[i] = angle;
-            fillPadding(posXPad, posYPad, anglePad, x_pos, y_pos, angle, width, height, interactionRadius);
-        }
-
-        // Define the quadtree boundary
-        float halfWidth = width/2.0f; // Adjust to your simulation space
-        float halfHeight = height/2.0f;
-        Quadtree::Boundary boundary = {halfWidth, halfHeight, halfWidth, halfHeight};
-        Quadtree tree(boundary, 8); // Set capacity per node
-
-        // Insert points into the Quadtree
-        for (int i = 0; i < nParticles; ++i) {
-            tree.insert({posX[i], posY[i], i});
-        }
-        for (int i = 0; i < posXPad.size(); ++i) {
-            tree.insert({posXPad[i], posYPad[i], -1}); // Use -1 or similar for padding points
-        }
-
-        // Move particles and calculate new angle of velocity
-        float vX = 0;
-        float vY = 0;
-        int parts = 0;
-        float x_pos_other = 0;
-        float y_pos_other = 0;
-
-        
-        for (int i = 0; i<nParticles; i++){
-            std::vector<int> neighbors;
-            tree.query(posX[i], posY[i], interactionRadius, neighbors);
-
-            float vX = 0.0f, vY = 0.0f;
-            int parts = 0;
-
-            // Process neighbors
-            // #pragma omp parallel for reduction(+:vX,vY)
-            for (int idx : neighbors) {
-                if (idx >= 0) { // Regular particle
-                    vX += velX[idx];
-                    vY += velY[idx];
-                } else { // Padding particle
-                    int padIdx = -(idx + 1);
-                    vX += velocity * std::cos(anglePad[padIdx]);
-                    vY += velocity * std::sin(anglePad[padIdx]);
-                }
-                ++parts;
-            }
-
-            /* // + wRand(generator)*noise;
-            float newAngle = 0;
-            vY = vY/(velocity*parts);// + sin(wRand(generator)*noise);
-            vX = vX/(velocity*parts);// + cos(wRand(generator)*noise);
-
-            newAngle = std::atan2((vY),(vX));
-            newAngle += wRand(generator)*noise;
- */
-            // Update particle velocity and position
-            if (parts > 0) {
-                vX /= (velocity * parts);
-                vY /= (velocity * parts);
+        bool done = finished;
+        if (latest.acquire()) {
+            const Snapshot &snapshot = latest.current();
+            renderProfiler.beginFrame(snapshot.step);
+            {
+                ScopedTimer timer(renderProfiler, Phase::Draw);
+                raster.draw(snapshot.posX.data(), snapshot.posY.data(), snapshot.angles.data(),
+                            params.nParticles, params.width, params.height, style);
             }
-            float newAngle = std::atan2(vY, vX) + wRand(generator) * noise;
-
-            newVelX[i] = velocity * std::cos(newAngle);
-            newVelY[i] = velocity * std::sin(newAngle);
-            newAngles[i] = newAngle;
-
-            newPosX[i] += newVelX[i];
-            newPosY[i] += newVelY[i];
-
-            if (newPosX[i] > width) {
-                newPosX[i]=0;
-            } else if (newPosX[i] < 0) {
-                newPosX[i] = width;
-            } else if (newPosY[i] > height) {
-                newPosY[i]=0;
-            } else if (newPosY[i] < 0) {
-                newPosY[i] = height;
+            {
+                ScopedTimer timer(renderProfiler, Phase::Present);
+                fw.show(raster.pixels.data());
+                SDL_RenderPresent(fw.renderer);      // Update rendering
             }
-            draw_pixel_white(fw.renderer,newPosX[i],newPosY[i]);
+            renderProfiler.endFrame();
+        } else if (done) {
+            break;
         }
-
-        std::swap(posX, newPosX);
-        std::swap(posY, newPosY);
-        std::swap(velX, newVelX);
-        std::swap(velY, newVelY);
-        std::swap(angles, newAngles);
-        // Update values for original swarm and draw them
-        /* 
-        for (int i = 0; i<nParticles; i++){
-            
-        } */
-        posXPad.clear();
-        posYPad.clear();
-        anglePad.clear();
-
-        SDL_RenderPresent(fw.renderer);      // Update rendering
         SDL_PumpEvents();                 // Check if 'q' was pressed
+
+        // 'p' switches profiling on and off, once per key press
+        if (state[SDL_SCANCODE_P] && !profileKeyDown) {
+            renderProfiler.enabled = !renderProfiler.enabled;
+            toggleProfile = true;
+            std::cout << "profiling " << (renderProfiler.enabled ? "on" : "off") << "\n";
+        }
+        profileKeyDown = state[SDL_SCANCODE_P];
         SDL_Delay(1);
-        iteration++;
     }
+    stop = true;
+    simulation.join();
+    sim.profiler.printSummary(std::cout, "step");
+    renderProfiler.printSummary(std::cout, "rendered frame");
 
     ///////////////////////////////////////////////////////////////////////
     while (1) {
@@ -380,5 +605,93 @@ int main(int argc, char * argv[]){
             break;
         SDL_Delay(2);
     }
+    return 0;
+}
+
+
+// Headless run of an engine with only the observables log as output:
+// CompactSimulation or Swarm<3>
+template <typename Model>
+int runObserved(const Params &params, const char* name){
+    Model sim(params);
+    long steps = params.steps > 0 ? params.steps : 1000;
+    std::ofstream observeFile;
+    if (!params.observePath.empty()) {
+        observeFile.open(params.observePath);
+        if (!observeFile) {
+            std::cerr << "Could not open observables file " << params.observePath << "\n";
+            return 1;
+        }
+    }
+    std::ostream &observeLog = observeFile.is_open() ? observeFile : std::cout;
+    if (params.observeEvery > 0) {
+        observeLog << "# step polar_order mean_heading mean_neighbors\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (long s = 0; s<steps; s++){
+        sim.step();
+        if (params.observeEvery > 0 && sim.iteration % params.observeEvery == 0) {
+            const Observables &obs = sim.observables;
+            observeLog << obs.step << " " << obs.polarOrder << " "
+                       << obs.meanHeading << " " << obs.meanNeighbors << "\n";
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "particles " << params.nParticles
+              << " steps " << steps
+              << " seed " << sim.params.seed
+              << " " << name << " time " << seconds << " s"
+              << " (" << steps/seconds << " steps/s)\n";
+    return 0;
+}
+
+
+int main(int argc, char * argv[]){
+    Params params;
+    SweepParams sweep;
+    ValidateParams validate;
+    if (!parseArgs(argc, argv, params, sweep, validate)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (sweep.enabled) {
+        return runSweep(params, sweep);
+    }
+    if (!validate.engines.empty()) {
+        return runValidation(params, validate);
+    }
+    if (params.compact) {
+        return runObserved<CompactSimulation>(params, "compact");
+    }
+    if (params.dimensions == 3) {
+        return runObserved<Swarm<3>>(params, "3d");
+    }
+    if (!params.restartPath.empty()) {
+        if (!readCheckpointParams(params.restartPath, params)) {
+            return 1;
+        }
+        if (const char* conflict = verletConflict(params)) {
+            std::cerr << params.restartPath << ": --" << conflict << "\n";
+            return 1;
+        }
+    }
+    Simulation sim(params);
+    sim.profiler.enabled = params.profile;
+    if (!params.restartPath.empty() && !loadCheckpoint(params.restartPath, sim)) {
+        return 1;
+    }
+
+    if (params.fastMath) {
+        FastMathError err = fastMathMaxError();
+        std::cout << "fast-math max error: sincos " << err.sinCos
+                  << ", atan2 " << err.atan2 << " rad\n";
+    }
+
+    if (params.headless) {
+        return runHeadless(sim);
+    }
 
+    return runWindow(sim);
 }
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+
+// Spread the lower 16 bits of v so there is a zero bit between each of them
+inline uint32_t spreadBits(uint32_t v) {
+    v &= 0x0000FFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+
+// Z-order key of a position in the box [0, width] x [0, height], 16 bits per
+// axis with x in the even bits. Positions close in space get close keys.
+inline uint32_t mortonKey(float x, float y, float width, float height) {
+    int qx = std::min(std::max(int(x / width * 65536.0f), 0), 65535);
+    int qy = std::min(std::max(int(y / height * 65536.0f), 0), 65535);
+    return spreadBits(qx) | (spreadBits(qy) << 1);
+}
+
+
+// LSD radix sort of (key, order) pairs, 8 bits per pass. The temporaries are
+// passed in so sorting every step does not allocate once they have grown.
+inline void radixSortByKey(std::vector<uint32_t>& keys, std::vector<int>& order,
+                           std::vector<uint32_t>& keysTmp, std::vector<int>& orderTmp) {
+    int n = keys.size();
+    keysTmp.resize(n);
+    orderTmp.resize(n);
+    for (int shift = 0; shift < 32; shift += 8) {
+        int count[257] = {0};
+        for (int i = 0; i < n; i++) {
+            count[((keys[i] >> shift) & 0xFF) + 1]++;
+        }
+        for (int b = 0; b < 256; b++) {
+            count[b + 1] += count[b];
+        }
+        for (int i = 0; i < n; i++) {
+            int dst = count[(keys[i] >> shift) & 0xFF]++;
+            keysTmp[dst] = keys[i];
+            orderTmp[dst] = order[i];
+        }
+        keys.swap(keysTmp);
+        order.swap(orderTmp);
+    }
+}
@@ -0,0 +1,168 @@
+#include <mpi.h>
+#include <stdlib.h>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "domain.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+// Headless run split over MPI ranks in slabs along x, see SlabDomain.
+// Start with e.g. mpirun -np 4 ./Vicsek_MPI --n 1000000 --width 10000 --height 10000
+// Each rank uses OpenMP inside its slab; on one machine, ranks x threads
+// should not exceed the cores.
+
+
+void printUsage(const char* prog){
+    std::cerr << "Usage: mpirun -np <ranks> " << prog << " [options]\n"
+              << "  --n <int>           number of particles (default 7000)\n"
+              << "  --width <float>     box width, cut into one slab per rank (default 900)\n"
+              << "  --height <float>    box height (default 900)\n"
+              << "  --noise <float>     noise amplitude (default 0.7)\n"
+              << "  --noise-dist <name> uniform (default) or gaussian, as in Vicsek_Model\n"
+              << "  --radius <float>    interaction radius (default 10)\n"
+              << "  --velocity <float>  particle speed (default 2)\n"
+              << "  --steps <int>       number of steps (default 1000)\n"
+              << "  --seed <int>        random seed, same initial state as Vicsek_Model\n"
+              << "  --observe <int>     log polar order, mean heading and neighbours every K steps\n"
+              << "  --observe-file <file>  write the observables log to a file instead of stdout\n"
+              << "  --threads <int>     OpenMP threads per rank\n";
+}
+
+
+bool parseArgs(int argc, char * argv[], Params &params){
+    for (int i = 1; i<argc; i++){
+        const char* arg = argv[i];
+        const char* value = (i+1 < argc) ? argv[i+1] : nullptr;
+        if (value == nullptr) return false;
+        if (std::strcmp(arg, "--n") == 0) {
+            params.nParticles = std::atoi(value);
+        } else if (std::strcmp(arg, "--width") == 0) {
+            params.width = std::atof(value);
+        } else if (std::strcmp(arg, "--height") == 0) {
+            params.height = std::atof(value);
+        } else if (std::strcmp(arg, "--noise") == 0) {
+            params.noise = std::atof(value);
+        } else if (std::strcmp(arg, "--noise-dist") == 0) {
+            if (std::strcmp(value, "uniform") == 0) {
+                params.noiseDistribution = NoiseDistribution::Uniform;
+            } else if (std::strcmp(value, "gaussian") == 0) {
+                params.noiseDistribution = NoiseDistribution::Gaussian;
+            } else {
+                return false;
+            }
+        } else if (std::strcmp(arg, "--radius") == 0) {
+            params.interactionRadius = std::atof(value);
+        } else if (std::strcmp(arg, "--velocity") == 0) {
+            params.velocity = std::atof(value);
+        } else if (std::strcmp(arg, "--steps") == 0) {
+            params.steps = std::atol(value);
+        } else if (std::strcmp(arg, "--seed") == 0) {
+            params.seed = std::strtoul(value, nullptr, 10);
+            params.randomSeed = false;
+        } else if (std::strcmp(arg, "--observe") == 0) {
+            params.observeEvery = std::atoi(value);
+        } else if (std::strcmp(arg, "--observe-file") == 0) {
+            params.observePath = value;
+        } else if (std::strcmp(arg, "--threads") == 0) {
+#ifdef _OPENMP
+            omp_set_num_threads(std::atoi(value));
+#endif
+        } else {
+            return false;
+        }
+        i++;
+    }
+    return params.nParticles > 0 && params.width > 0 && params.height > 0 &&
+           params.interactionRadius > 0 && params.steps >= 0 && params.observeEvery >= 0;
+}
+
+
+int run(const Params &params){
+    SlabDomain domain(params, MPI_COMM_WORLD);
+    bool root = domain.rank == 0;
+    if (!domain.valid()) {
+        if (root) {
+            std::cerr << "Slabs of width " << params.width / domain.ranks
+                      << " are thinner than the interaction radius or the velocity, use fewer ranks\n";
+        }
+        return 1;
+    }
+    long steps = params.steps > 0 ? params.steps : 1000;
+
+    std::ofstream observeFile;
+    if (root && !params.observePath.empty()) {
+        observeFile.open(params.observePath);
+        if (!observeFile) {
+            std::cerr << "Could not open observables file " << params.observePath << "\n";
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    std::ostream &observeLog = observeFile.is_open() ? observeFile : std::cout;
+    if (root && params.observeEvery > 0) {
+        observeLog << "# step polar_order mean_heading mean_neighbors\n";
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start = std::chrono::steady_clock::now();
+    long halo = 0, migrated = 0;
+    for (long s = 0; s<steps; s++){
+        domain.step();
+        halo += domain.haloCount;
+        migrated += domain.migrated;
+        if (root && params.observeEvery > 0 && domain.iteration % params.observeEvery == 0) {
+            const Observables &obs = domain.observables;
+            observeLog << obs.step << " " << obs.polarOrder << " "
+                       << obs.meanHeading << " " << obs.meanNeighbors << "\n";
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Load balance: the particles of the busiest and the idlest rank
+    long local = domain.localCount(), most = 0, least = 0, totals[2] = {0, 0}, counts[2] = {halo, migrated};
+    MPI_Reduce(&local, &most, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&local, &least, 1, MPI_LONG, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(counts, totals, 2, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (root) {
+        int threads = 1;
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#endif
+        std::cout << "particles " << params.nParticles
+                  << " steps " << steps
+                  << " seed " << domain.params.seed
+                  << " ranks " << domain.ranks << " x " << threads << " threads"
+                  << " time " << seconds << " s"
+                  << " (" << steps/seconds << " steps/s, "
+                  << seconds * 1e9 / (double(steps) * params.nParticles) << " ns/particle-step)\n"
+                  << "per step: halo " << totals[0] / steps << " migrated " << totals[1] / steps
+                  << ", particles per rank " << least << " to " << most << "\n";
+    }
+    return 0;
+}
+
+
+int main(int argc, char * argv[]){
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    Params params;
+    params.headless = true;
+    int status;
+    if (!parseArgs(argc, argv, params)) {
+        int rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        if (rank == 0) printUsage(argv[0]);
+        status = 1;
+    } else {
+        status = run(params);
+    }
+    MPI_Finalize();
+    return status;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+
+#include "fast_math.h"
+#include "rng.h"
+#include "simd_kernel.h"
+
+
+// Distribution of the angle added to the mean heading each step
+enum class NoiseDistribution {
+    Uniform,        // noise * U[-1/2, 1/2), the original Vicsek rule
+    Gaussian        // N(0, noise^2) wrapped into [-pi, pi)
+};
+
+
+// Words 0 and 1 of Philox4x32(seed, step, index[j]) for j < count
+typedef void (*PhiloxBatchFunction)(uint64_t seed, uint64_t step, const int* index, int count,
+                                    uint32_t* v0, uint32_t* v1);
+
+
+#ifdef VICSEK_X86_SIMD
+
+// Philox rounds on 8 lanes. mul_epu32 only multiplies the even 32-bit lanes,
+// so the odd ones are shifted down and multiplied separately, then the high
+// and low halves of both are blended back into lane order.
+__attribute__((target("avx2")))
+inline void philoxBatchAVX2(uint64_t seed, uint64_t step, const int* index, int count,
+                            uint32_t* v0, uint32_t* v1) {
+    const __m256i m0 = _mm256_set1_epi64x(0xD2511F53u);
+    const __m256i m1 = _mm256_set1_epi64x(0xCD9E8D57u);
+    int j = 0;
+    for (; j + 8 <= count; j += 8) {
+        __m256i c0 = _mm256_loadu_si256((const __m256i*)(index + j));
+        __m256i c1 = _mm256_setzero_si256();
+        __m256i c2 = _mm256_set1_epi32(int(uint32_t(step)));
+        __m256i c3 = _mm256_set1_epi32(int(uint32_t(step >> 32)));
+        uint32_t key0 = uint32_t(seed), key1 = uint32_t(seed >> 32);
+        for (int round = 0; round < 10; round++) {
+            __m256i p0Even = _mm256_mul_epu32(c0, m0);
+            __m256i p0Odd = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), m0);
+            __m256i p1Even = _mm256_mul_epu32(c2, m1);
+            __m256i p1Odd = _mm256_mul_epu32(_mm256_srli_epi64(c2, 32), m1);
+            __m256i hi0 = _mm256_blend_epi32(_mm256_srli_epi64(p0Even, 32), p0Odd, 0xAA);
+            __m256i hi1 = _mm256_blend_epi32(_mm256_srli_epi64(p1Even, 32), p1Odd, 0xAA);
+            __m256i lo0 = _mm256_blend_epi32(p0Even, _mm256_slli_epi64(p0Odd, 32), 0xAA);
+            __m256i lo1 = _mm256_blend_epi32(p1Even, _mm256_slli_epi64(p1Odd, 32), 0xAA);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(int(key0)));
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(int(key1)));
+            c1 = lo1;
+            c3 = lo0;
+            key0 += 0x9E3779B9u;
+            key1 += 0xBB67AE85u;
+        }
+        _mm256_storeu_si256((__m256i*)(v0 + j), c0);
+        _mm256_storeu_si256((__m256i*)(v1 + j), c1);
+    }
+    philoxBatch(seed, step, index + j, count - j, v0 + j, v1 + j);
+}
+
+// The same on 16 lanes. The zero-masked forms of the shifts and multiplies
+// keep GCC from warning about the undefined source of the unmasked ones.
+__attribute__((target("avx512f")))
+inline void philoxBatchAVX512(uint64_t seed, uint64_t step, const int* index, int count,
+                              uint32_t* v0, uint32_t* v1) {
+    const __m512i m0 = _mm512_set1_epi64(0xD2511F53u);
+    const __m512i m1 = _mm512_set1_epi64(0xCD9E8D57u);
+    const __mmask16 odd = 0xAAAA;
+    const __mmask8 all = 0xFF;
+    int j = 0;
+    for (; j + 16 <= count; j += 16) {
+        __m512i c0 = _mm512_loadu_si512(index + j);
+        __m512i c1 = _mm512_setzero_si512();
+        __m512i c2 = _mm512_set1_epi32(int(uint32_t(step)));
+        __m512i c3 = _mm512_set1_epi32(int(uint32_t(step >> 32)));
+        uint32_t key0 = uint32_t(seed), key1 = uint32_t(seed >> 32);
+        for (int round = 0; round < 10; round++) {
+            __m512i p0Even = _mm512_maskz_mul_epu32(all, c0, m0);
+            __m512i p0Odd = _mm512_maskz_mul_epu32(all, _mm512_maskz_srli_epi64(all, c0, 32), m0);
+            __m512i p1Even = _mm512_maskz_mul_epu32(all, c2, m1);
+            __m512i p1Odd = _mm512_maskz_mul_epu32(all, _mm512_maskz_srli_epi64(all, c2, 32), m1);
+            __m512i hi0 = _mm512_mask_blend_epi32(odd, _mm512_maskz_srli_epi64(all, p0Even, 32), p0Odd);
+            __m512i hi1 = _mm512_mask_blend_epi32(odd, _mm512_maskz_srli_epi64(all, p1Even, 32), p1Odd);
+            __m512i lo0 = _mm512_mask_blend_epi32(odd, p0Even, _mm512_maskz_slli_epi64(all, p0Odd, 32));
+            __m512i lo1 = _mm512_mask_blend_epi32(odd, p1Even, _mm512_maskz_slli_epi64(all, p1Odd, 32));
+            c0 = _mm512_xor_si512(_mm512_xor_si512(hi1, c1), _mm512_set1_epi32(int(key0)));
+            c2 = _mm512_xor_si512(_mm512_xor_si512(hi0, c3), _mm512_set1_epi32(int(key1)));
+            c1 = lo1;
+            c3 = lo0;
+            key0 += 0x9E3779B9u;
+            key1 += 0xBB67AE85u;
+        }
+        _mm512_storeu_si512(v0 + j, c0);
+        _mm512_storeu_si512(v1 + j, c1);
+    }
+    philoxBatch(seed, step, index + j, count - j, v0 + j, v1 + j);
+}
+
+#endif
+
+
+// Widest Philox the CPU supports, picked once. All give the same words.
+inline PhiloxBatchFunction philoxBatchFunction() {
+    static PhiloxBatchFunction function = [] {
+#ifdef VICSEK_X86_SIMD
+        if (__builtin_cpu_supports("avx512f")) return philoxBatchAVX512;
+        if (__builtin_cpu_supports("avx2")) return philoxBatchAVX2;
+#endif
+        return philoxBatch;
+    }();
+    return function;
+}
+
+
+// Particles per batch, the Philox words of a batch stay on the stack
+const int noiseBatch = 256;
+
+
+// Noise angles of all particles for one step, out[i] for particle ids[i].
+// The Philox words are drawn a batch at a time with the vector kernels
+// above, from the same (seed, step, id) counters as counterUniform, so
+// uniform noise is bit for bit what the per-particle draw gives. The float
+// part is plain code for every CPU, built with -ffp-contract=off (see
+// CMakeLists.txt) so no FMA is formed, and results do not depend on the
+// instruction set. Gaussian noise is Box-Muller on the two
+// words, with polynomial log and sincos so that loop vectorizes too.
+inline void fillNoise(float* out, const int* ids, int n, uint64_t seed, uint64_t step,
+                      float noise, NoiseDistribution distribution) {
+    const PhiloxBatchFunction philox = philoxBatchFunction();
+    const float pi = 3.14159265f;
+    const int nBatches = (n + noiseBatch - 1) / noiseBatch;
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < nBatches; b++) {
+        const int first = b * noiseBatch;
+        const int count = std::min(noiseBatch, n - first);
+        uint32_t v0[noiseBatch], v1[noiseBatch];
+        philox(seed, step, ids + first, count, v0, v1);
+        float* batch = out + first;
+        if (distribution == NoiseDistribution::Uniform) {
+            #pragma omp simd
+            for (int j = 0; j < count; j++) {
+                batch[j] = (toUnitFloat(v0[j]) - 0.5f) * noise;
+            }
+        } else {
+            #pragma omp simd
+            for (int j = 0; j < count; j++) {
+                float u = 1.0f - toUnitFloat(v0[j]);        // (0, 1], log stays finite
+                float r = std::sqrt(-2.0f * fastLog(u));
+                float s, c;
+                fastSinCos(toUnitFloat(v1[j]) * (2 * pi) - pi, s, c);
+                float a = noise * r * c;
+                // Wrap into [-pi, pi] by the nearest whole turn
+                float turns = a * (1 / (2 * pi));
+                a -= (2 * pi) * float(int(turns + (turns < 0 ? -0.5f : 0.5f)));
+                batch[j] = a;
+            }
+        }
+    }
+}
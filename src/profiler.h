@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+
+
+// Phases of one frame of the main loop, timed by Profiler
+enum class Phase {
+    Reorder,        // Morton sort of the particle arrays
+    Padding,        // Ghost copies for the pointer Quadtree
+    Build,          // Spatial index construction
+    Noise,          // Noise angles of all particles
+    Query,          // Neighbour search and velocity sums
+    Update,         // Heading update, move and wrap
+    Output,         // Trajectory, observables and checkpoints
+    Draw,           // Rendering the particles
+    Present,        // SDL_RenderPresent and event handling
+    Count
+};
+
+inline const char* phaseName(Phase phase) {
+    static const char* names[] = {"reorder", "padding", "build", "noise", "query", "update",
+                                  "output", "draw", "present"};
+    return names[int(phase)];
+}
+
+
+// Timings and counters of one frame
+struct FrameProfile {
+    long step = 0;
+    double seconds[int(Phase::Count)] = {};
+    long ghosts = 0;                // Padding particles added for the boundary
+    double meanNeighbors = 0;       // Average particles found per query, excluding itself
+    int treeDepth = 0;              // Levels of the quadtree, 0 for the other engines
+};
+
+
+// Per-phase wall-clock times of the main loop. Disabled it costs one branch
+// per phase; enabled, two clock reads. Phases that run in parallel are timed
+// as a whole from the calling thread.
+class Profiler {
+public:
+    bool enabled = false;
+    FrameProfile frame;             // Frame being measured
+    FrameProfile total;             // Sum over all finished frames
+    long frames = 0;
+
+    void beginFrame(long step) {
+        frame = FrameProfile();
+        frame.step = step;
+    }
+
+    void endFrame() {
+        if (!enabled) return;
+        for (int p = 0; p < int(Phase::Count); p++) {
+            total.seconds[p] += frame.seconds[p];
+        }
+        total.ghosts += frame.ghosts;
+        total.meanNeighbors += frame.meanNeighbors;
+        total.treeDepth = std::max(total.treeDepth, frame.treeDepth);
+        frames++;
+    }
+
+    // Mean time per frame of each phase, unit names what a frame is
+    void printSummary(std::ostream& out, const char* unit = "frame") const {
+        if (frames == 0) return;
+        double all = 0;
+        for (int p = 0; p < int(Phase::Count); p++) {
+            all += total.seconds[p];
+        }
+        out << "profile over " << frames << " " << unit << "s (ms per " << unit << "):\n";
+        for (int p = 0; p < int(Phase::Count); p++) {
+            if (total.seconds[p] == 0) continue;
+            out << "  " << std::left << std::setw(8) << phaseName(Phase(p)) << std::right << std::fixed
+                << std::setprecision(3) << std::setw(10) << 1e3 * total.seconds[p] / frames
+                << std::setprecision(1) << std::setw(7) << 100 * total.seconds[p] / all << " %\n";
+        }
+        out << std::defaultfloat << std::setprecision(6);
+        if (total.ghosts == 0 && total.meanNeighbors == 0 && total.treeDepth == 0) return;
+        out << "  ghosts " << double(total.ghosts) / frames
+            << ", neighbours " << total.meanNeighbors / frames
+            << ", max tree depth " << total.treeDepth << "\n";
+    }
+};
+
+
+// Adds the time until the end of the scope to one phase of the current frame
+class ScopedTimer {
+public:
+    ScopedTimer(Profiler& profiler_, Phase phase_): profiler(profiler_), phase(phase_) {
+        if (profiler.enabled) start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedTimer() {
+        if (profiler.enabled) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            profiler.frame.seconds[int(phase)] += elapsed.count();
+        }
+    }
+
+private:
+    Profiler& profiler;
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+
+// Write frames as CSV rows or as a JSON array of objects
+inline void writeProfileHeader(std::ostream& out, bool json) {
+    if (json) {
+        out << "[";
+        return;
+    }
+    out << "step";
+    for (int p = 0; p < int(Phase::Count); p++) {
+        out << "," << phaseName(Phase(p)) << "_ms";
+    }
+    out << ",ghosts,mean_neighbors,tree_depth\n";
+}
+
+inline void writeProfileFrame(std::ostream& out, bool json, bool first, const FrameProfile& frame) {
+    if (json) {
+        out << (first ? "\n" : ",\n") << "  {\"step\": " << frame.step;
+        for (int p = 0; p < int(Phase::Count); p++) {
+            out << ", \"" << phaseName(Phase(p)) << "_ms\": " << 1e3 * frame.seconds[p];
+        }
+        out << ", \"ghosts\": " << frame.ghosts << ", \"mean_neighbors\": " << frame.meanNeighbors
+            << ", \"tree_depth\": " << frame.treeDepth << "}";
+        return;
+    }
+    out << frame.step;
+    for (int p = 0; p < int(Phase::Count); p++) {
+        out << "," << 1e3 * frame.seconds[p];
+    }
+    out << "," << frame.ghosts << "," << frame.meanNeighbors << "," << frame.treeDepth << "\n";
+}
+
+inline void writeProfileFooter(std::ostream& out, bool json) {
+    if (json) out << "\n]\n";
+}
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "morton.h"
+#include "simd_kernel.h"
+
+
+// Define a struct for points
+struct Point {
+    float x, y;
+    int index; // Original index in the arrays for reference
+};
+
+// Define a class for the Quadtree
+class Quadtree {
+public:
+    // Define the boundary of the quadtree
+    struct Boundary {
+        float x, y; // Center of the boundary
+        float halfWidth, halfHeight; // Half-dimensions
+    } boundary;
+
+    int capacity; // Maximum points in a node before subdivision
+    std::vector<Point> points; // Points stored in this node
+    bool divided = false; // Whether this node is subdivided
+    Quadtree* northwest = nullptr;
+    Quadtree* northeast = nullptr;
+    Quadtree* southwest = nullptr;
+    Quadtree* southeast = nullptr;
+
+    // Constructor
+    Quadtree(Boundary boundary, int capacity)
+        : boundary(boundary), capacity(capacity) {}
+
+    ~Quadtree() {
+        delete northwest;
+        delete northeast;
+        delete southwest;
+        delete southeast;
+    }
+
+    // Insert a point into the Quadtree
+    bool insert(const Point& point) {
+        // Check if the point is within the boundary
+        if (!contains(point)) return false;
+
+        // If there's space, add the point
+        if (points.size() < capacity) {
+            points.push_back(point);
+            return true;
+        }
+
+        // Otherwise, subdivide if necessary
+        if (!divided) subdivide();
+
+        // Insert into the appropriate quadrant
+        return northwest->insert(point) || northeast->insert(point) ||
+               southwest->insert(point) || southeast->insert(point);
+    }
+
+    // Query points within a radius
+    void query(float x, float y, float radius, std::vector<int>& found) const {
+        // Check if the search area intersects this boundary
+        if (!intersects(x, y, radius)) return;
+
+        // Check points in this node
+        for (const auto& point : points) {
+            float dx = x - point.x;
+            float dy = y - point.y;
+            if (dx * dx + dy * dy <= radius * radius) {
+                found.push_back(point.index);
+            }
+        }
+
+        // Query children if divided
+        if (divided) {
+            northwest->query(x, y, radius, found);
+            northeast->query(x, y, radius, found);
+            southwest->query(x, y, radius, found);
+            southeast->query(x, y, radius, found);
+        }
+    }
+
+    // Number of levels below this node
+    int depth() const {
+        if (!divided) return 0;
+        return 1 + std::max(std::max(northwest->depth(), northeast->depth()),
+                            std::max(southwest->depth(), southeast->depth()));
+    }
+
+private:
+    // Check if a point is within the boundary
+    bool contains(const Point& point) const {
+        return point.x >= boundary.x - boundary.halfWidth &&
+               point.x < boundary.x + boundary.halfWidth &&
+               point.y >= boundary.y - boundary.halfHeight &&
+               point.y < boundary.y + boundary.halfHeight;
+    }
+
+    // Check if a circle intersects the boundary
+    bool intersects(float x, float y, float radius) const {
+        float dx = std::max(std::abs(x - boundary.x) - boundary.halfWidth, 0.0f);
+        float dy = std::max(std::abs(y - boundary.y) - boundary.halfHeight, 0.0f);
+        return (dx * dx + dy * dy) <= radius * radius;
+    }
+
+    // Subdivide the Quadtree into four quadrants
+    void subdivide() {
+        float hw = boundary.halfWidth / 2.0f;
+        float hh = boundary.halfHeight / 2.0f;
+
+        northwest = new Quadtree({boundary.x - hw, boundary.y - hh, hw, hh}, capacity);
+        northeast = new Quadtree({boundary.x + hw, boundary.y - hh, hw, hh}, capacity);
+        southwest = new Quadtree({boundary.x - hw, boundary.y + hh, hw, hh}, capacity);
+        southeast = new Quadtree({boundary.x + hw, boundary.y + hh, hw, hh}, capacity);
+
+        divided = true;
+    }
+};
+
+
+
+// Add copies of particles outside of bound so that a particle close to an edge
+// can interact with a particle on the opposite side of the periodic boundary
+void fillPadding(std::vector<float> &posXPad, std::vector<float> &posYPad, 
+                 std::vector<float> &anglePad, float x_pos, float y_pos, float angle, 
+                 float xMax, float yMax, float interactionRadius) {
+
+    // Check for boundary interactions and add padded particles
+    if (x_pos + interactionRadius > xMax) {
+        posXPad.push_back(x_pos - xMax); // Wrap around X (right to left)
+        posYPad.push_back(y_pos);        // Same Y
+        anglePad.push_back(angle);
+    } else if (x_pos - interactionRadius < 0) {
+        posXPad.push_back(x_pos + xMax); // Wrap around X (left to right)
+        posYPad.push_back(y_pos);        // Same Y
+        anglePad.push_back(angle);
+    } 
+    if (y_pos + interactionRadius > yMax) {
+        posXPad.push_back(x_pos);        // Same X
+        posYPad.push_back(y_pos); // Wrap around Y (top to bottom)
+        anglePad.push_back(angle);
+    } else if (y_pos - interactionRadius < 0) {
+        posXPad.push_back(x_pos);        // Same X
+        posYPad.push_back(y_pos + yMax); // Wrap around Y (bottom to top)
+        anglePad.push_back(angle);
+    }
+}
+
+
+// Quadtree stored as flat arrays instead of linked nodes. Points are sorted
+// by Morton key so every node owns a contiguous slot range, and the four
+// children of a node split that range at the next two bits of the key.
+// Node and point buffers persist between builds, so a rebuild does no heap
+// allocation once they have grown, and queries call a visitor instead of
+// filling a vector. Periodic images are queried directly, no padding.
+class FlatQuadtree {
+public:
+    struct Node {
+        float x, y;                     // Center of the boundary
+        float halfWidth, halfHeight;    // Half-dimensions
+        int first, last;                // Slot range of the points inside
+        int child;                      // First of four consecutive children, -1 for a leaf
+    };
+
+    int capacity = 8;                   // Maximum points in a leaf above the deepest level
+    int depth = 0;                      // Deepest level reached by the last build
+    float width = 0, height = 0;        // Size of the periodic box
+
+    std::vector<Node> nodes;            // Node arena, nodes[0] is the root
+    std::vector<int> index;             // Original particle index of each slot
+    std::vector<float> posX, posY;      // Positions in Morton order
+    std::vector<float> velX, velY;      // Velocities in Morton order
+
+    // Rebuild the tree in bulk from positions inside [0, width] x [0, height]
+    void build(const float* x, const float* y, const float* vx, const float* vy,
+               int n, float width_, float height_) {
+        width = width_;
+        height = height_;
+
+        keys.resize(n);
+        index.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            keys[i] = mortonKey(x[i], y[i], width, height);
+            index[i] = i;
+        }
+        radixSortByKey(keys, index, keysTmp, orderTmp);
+
+        posX.resize(n);
+        posY.resize(n);
+        velX.resize(n);
+        velY.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int slot = 0; slot < n; slot++) {
+            int i = index[slot];
+            posX[slot] = x[i];
+            posY[slot] = y[i];
+            velX[slot] = vx[i];
+            velY[slot] = vy[i];
+        }
+
+        nodes.clear();
+        nodes.push_back({width/2.0f, height/2.0f, width/2.0f, height/2.0f, 0, n, -1});
+        depth = 0;
+        subdivide(0, 0);
+    }
+
+    // Call visit(first, last, x, y) for every leaf whose boundary intersects
+    // the circle around (x, y) or one of its periodic images; (x, y) is then
+    // the image that matched. Assumes radius <= half the box size.
+    template <typename Visitor>
+    void forEachLeaf(float x, float y, float radius, Visitor&& visit) const {
+        float imagesX[2] = {x, x};
+        float imagesY[2] = {y, y};
+        int nX = 1, nY = 1;
+        if (x < radius) imagesX[nX++] = x + width;
+        else if (x > width - radius) imagesX[nX++] = x - width;
+        if (y < radius) imagesY[nY++] = y + height;
+        else if (y > height - radius) imagesY[nY++] = y - height;
+
+        for (int iy = 0; iy < nY; iy++) {
+            for (int ix = 0; ix < nX; ix++) {
+                leavesNear(imagesX[ix], imagesY[iy], radius, visit);
+            }
+        }
+    }
+
+    // Call visit(slot) for every point within radius of (x, y), periodic images included
+    template <typename Visitor>
+    void query(float x, float y, float radius, Visitor&& visit) const {
+        float radius2 = radius * radius;
+        forEachLeaf(x, y, radius, [&](int first, int last, float ix, float iy) {
+            for (int slot = first; slot < last; slot++) {
+                float dx = ix - posX[slot];
+                float dy = iy - posY[slot];
+                if (dx * dx + dy * dy <= radius2) {
+                    visit(slot);
+                }
+            }
+        });
+    }
+
+    // Sum velocities of all particles within radius of (x, y), itself included
+    void accumulate(float x, float y, float radius, float& vX, float& vY, int& parts) const {
+        float radius2 = radius * radius;
+        NeighborKernel kernel = activeNeighborKernel();
+        forEachLeaf(x, y, radius, [&](int first, int last, float ix, float iy) {
+            kernel(posX.data() + first, posY.data() + first, velX.data() + first, velY.data() + first, last - first,
+                   ix, iy, radius2, vX, vY, parts);
+        });
+    }
+
+private:
+    static const int maxLevel = 16;     // Keys hold 16 bits per axis
+    std::vector<uint32_t> keys, keysTmp;
+    std::vector<int> orderTmp;
+
+    void subdivide(int node, int level) {
+        depth = std::max(depth, level);
+        int first = nodes[node].first;
+        int last = nodes[node].last;
+        if (last - first <= capacity || level == maxLevel) return;
+
+        // Keys in this node share their top 2*level bits, the next two pick the quadrant
+        int shift = 30 - 2*level;
+        uint32_t base = keys[first] & uint32_t(~((uint64_t(1) << (shift + 2)) - 1));
+        int bounds[5] = {first, 0, 0, 0, last};
+        for (int q = 1; q < 4; q++) {
+            bounds[q] = std::lower_bound(keys.begin() + first, keys.begin() + last,
+                                         base | (uint32_t(q) << shift)) - keys.begin();
+        }
+
+        int child = nodes.size();
+        nodes[node].child = child;
+        float hw = nodes[node].halfWidth / 2.0f;
+        float hh = nodes[node].halfHeight / 2.0f;
+        float cx = nodes[node].x;
+        float cy = nodes[node].y;
+        for (int q = 0; q < 4; q++) {
+            float x = (q & 1) ? cx + hw : cx - hw;
+            float y = (q & 2) ? cy + hh : cy - hh;
+            nodes.push_back({x, y, hw, hh, bounds[q], bounds[q+1], -1});
+        }
+        for (int q = 0; q < 4; q++) {
+            subdivide(child + q, level + 1);
+        }
+    }
+
+    template <typename Visitor>
+    void leavesNear(float x, float y, float radius, Visitor& visit) const {
+        float radius2 = radius * radius;
+        int stack[4*maxLevel + 4];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if (node.first == node.last) continue;
+
+            // Check if the circle intersects the boundary
+            float dx = std::max(std::abs(x - node.x) - node.halfWidth, 0.0f);
+            float dy = std::max(std::abs(y - node.y) - node.halfHeight, 0.0f);
+            if (dx * dx + dy * dy > radius2) continue;
+
+            if (node.child < 0) {
+                visit(node.first, node.last, x, y);
+            } else {
+                for (int q = 0; q < 4; q++) {
+                    stack[top++] = node.child + q;
+                }
+            }
+        }
+    }
+};
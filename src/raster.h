@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+// How particles are drawn
+struct RenderStyle {
+    int dotRadius = 0;              // Pixels around the centre, 0 = a single pixel
+    bool headings = false;          // Line along the heading, coloured by angle
+    int headingLength = 6;          // Length of that line in pixels
+};
+
+
+// Draws the swarm into a 32-bit ARGB pixel buffer without any SDL call, so
+// the same image can go to a streaming texture or to a video file.
+// The image is cut into horizontal bands and every particle is drawn by the
+// band that holds its centre. Marks reach at most `extent` rows out of the
+// band and bands are taller than twice that, so all even bands can be drawn
+// in parallel, then all odd ones, without two threads touching one pixel.
+class Rasterizer {
+public:
+    int width = 0, height = 0;
+    std::vector<uint32_t> pixels;   // Row-major, width * height
+
+    void resize(int width_, int height_) {
+        width = width_;
+        height = height_;
+        pixels.assign(size_t(width) * height, 0);
+    }
+
+    // Clear to black and draw n particles of a width x height box (in
+    // simulation units), scaled to the pixel buffer with periodic wrap
+    void draw(const float* x, const float* y, const float* angles, int n,
+              float boxWidth, float boxHeight, const RenderStyle& style) {
+        const float scaleX = width / boxWidth;
+        const float scaleY = height / boxHeight;
+        const int extent = std::max(style.dotRadius, style.headings ? style.headingLength : 0);
+
+        int threads = 1;
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#endif
+        // Bands of height / nBands rows, an even number of them so the first
+        // and last band (neighbours through the wrap) are never drawn together
+        int nBands = std::min(4 * threads, height / (2 * extent + 2));
+        nBands = std::max(2, nBands - nBands % 2);
+        if (height < 2 * (2 * extent + 2)) nBands = 1;
+
+        // Counting sort of the particles by band
+        pixelX.resize(n);
+        pixelY.resize(n);
+        bandOf.resize(n);
+        order.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            int px = std::min(std::max(int(x[i] * scaleX), 0), width - 1);
+            int py = std::min(std::max(int(y[i] * scaleY), 0), height - 1);
+            pixelX[i] = px;
+            pixelY[i] = py;
+            bandOf[i] = int(int64_t(py) * nBands / height);
+        }
+        bandStart.assign(nBands + 1, 0);
+        for (int i = 0; i < n; i++) {
+            bandStart[bandOf[i] + 1]++;
+        }
+        for (int b = 0; b < nBands; b++) {
+            bandStart[b + 1] += bandStart[b];
+        }
+        fill.assign(bandStart.begin(), bandStart.end() - 1);
+        for (int i = 0; i < n; i++) {
+            order[fill[bandOf[i]]++] = i;
+        }
+
+        std::fill(pixels.begin(), pixels.end(), 0xFF000000u);
+        for (int parity = 0; parity < 2; parity++) {
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (int b = parity; b < nBands; b += 2) {
+                for (int slot = bandStart[b]; slot < bandStart[b + 1]; slot++) {
+                    int i = order[slot];
+                    if (style.headings) {
+                        drawHeading(pixelX[i], pixelY[i], angles[i], style.headingLength);
+                    }
+                    drawDot(pixelX[i], pixelY[i], style.dotRadius);
+                }
+            }
+        }
+    }
+
+    // Fully saturated colour wheel, angle in radians
+    static uint32_t angleColor(float angle) {
+        float t = angle * 0.15915494f;          // 1 / (2 pi)
+        t -= std::floor(t);
+        float h = t * 6;
+        int sector = std::min(int(h), 5);
+        int rise = int((h - sector) * 255);
+        int fall = 255 - rise;
+        int r, g, b;
+        switch (sector) {
+            case 0: r = 255; g = rise; b = 0; break;
+            case 1: r = fall; g = 255; b = 0; break;
+            case 2: r = 0; g = 255; b = rise; break;
+            case 3: r = 0; g = fall; b = 255; break;
+            case 4: r = rise; g = 0; b = 255; break;
+            default: r = 255; g = 0; b = fall; break;
+        }
+        return 0xFF000000u | uint32_t(r) << 16 | uint32_t(g) << 8 | uint32_t(b);
+    }
+
+private:
+    std::vector<int> pixelX, pixelY, bandOf, order, bandStart, fill;
+
+    // Wraps any offset, dots and headings may be larger than the frame
+    void plot(int px, int py, uint32_t color) {
+        if (unsigned(px) >= unsigned(width)) px = (px % width + width) % width;
+        if (unsigned(py) >= unsigned(height)) py = (py % height + height) % height;
+        pixels[size_t(py) * width + px] = color;
+    }
+
+    // Filled disc, integer test instead of pow
+    void drawDot(int cx, int cy, int radius) {
+        int radius2 = radius * radius;
+        for (int dy = -radius; dy <= radius; dy++) {
+            for (int dx = -radius; dx <= radius; dx++) {
+                if (dx * dx + dy * dy <= radius2) plot(cx + dx, cy + dy, 0xFFFFFFFFu);
+            }
+        }
+    }
+
+    // One pixel per step along the heading (DDA)
+    void drawHeading(int cx, int cy, float angle, int length) {
+        uint32_t color = angleColor(angle);
+        float dx = std::cos(angle), dy = std::sin(angle);
+        for (int k = 1; k <= length; k++) {
+            plot(cx + int(std::lround(k * dx)), cy + int(std::lround(k * dy)), color);
+        }
+    }
+};
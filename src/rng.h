@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al. SC'11).
+// A draw is a pure function of (seed, step, particle index), so particles
+// can be updated in any order on any number of threads and still see the
+// same noise, and a run can be resumed from just the seed and step number.
+struct Philox4x32 {
+    uint32_t v[4];
+
+    Philox4x32(uint64_t seed, uint64_t step, uint32_t index, uint32_t stream = 0) {
+        uint32_t ctr[4] = {index, stream, uint32_t(step), uint32_t(step >> 32)};
+        uint32_t key[2] = {uint32_t(seed), uint32_t(seed >> 32)};
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = uint64_t(0xD2511F53u) * ctr[0];
+            uint64_t p1 = uint64_t(0xCD9E8D57u) * ctr[2];
+            uint32_t next[4] = {
+                uint32_t(p1 >> 32) ^ ctr[1] ^ key[0], uint32_t(p1),
+                uint32_t(p0 >> 32) ^ ctr[3] ^ key[1], uint32_t(p0)};
+            ctr[0] = next[0]; ctr[1] = next[1]; ctr[2] = next[2]; ctr[3] = next[3];
+            key[0] += 0x9E3779B9u;
+            key[1] += 0xBB67AE85u;
+        }
+        v[0] = ctr[0]; v[1] = ctr[1]; v[2] = ctr[2]; v[3] = ctr[3];
+    }
+};
+
+
+// Map 32 random bits to a float uniform in [0, 1) using the top 24 bits
+inline float toUnitFloat(uint32_t bits) {
+    return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+
+// Noise of particle `index` at time `step`, uniform in [-0.5, 0.5)
+inline float counterUniform(uint64_t seed, uint64_t step, uint32_t index) {
+    return toUnitFloat(Philox4x32(seed, step, index).v[0]) - 0.5f;
+}
+
+
+// Philox4x32-10 of many indices at once: words 0 and 1 of
+// Philox4x32(seed, step, index[j]) for each j < count. The lanes are
+// independent, so the loop over them vectorizes with the ten rounds
+// unrolled inside and the 32x32->64 bit multiplies as pmuludq, which the
+// one-at-a-time struct cannot do.
+inline void philoxBatch(uint64_t seed, uint64_t step, const int* index, int count,
+                        uint32_t* v0, uint32_t* v1) {
+    const uint32_t seedLow = uint32_t(seed), seedHigh = uint32_t(seed >> 32);
+    const uint32_t stepLow = uint32_t(step), stepHigh = uint32_t(step >> 32);
+    #pragma omp simd
+    for (int j = 0; j < count; j++) {
+        uint32_t c0 = uint32_t(index[j]), c1 = 0, c2 = stepLow, c3 = stepHigh;
+        uint32_t key0 = seedLow, key1 = seedHigh;
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = uint64_t(0xD2511F53u) * c0;
+            uint64_t p1 = uint64_t(0xCD9E8D57u) * c2;
+            c0 = uint32_t(p1 >> 32) ^ c1 ^ key0;
+            c1 = uint32_t(p1);
+            c2 = uint32_t(p0 >> 32) ^ c3 ^ key1;
+            c3 = uint32_t(p0);
+            key0 += 0x9E3779B9u;
+            key1 += 0xBB67AE85u;
+        }
+        v0[j] = c0;
+        v1[j] = c1;
+    }
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define VICSEK_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+
+// Instruction set used by the neighbour accumulation kernel
+enum class SimdLevel {
+    Auto,       // Best level supported by the CPU
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+
+// Test a block of `count` candidates in SoA layout against the target (x, y)
+// and add the velocities of those within radius to vX/vY, counting them in
+// parts. The target is already shifted to the periodic image of the block.
+typedef void (*NeighborKernel)(const float* posX, const float* posY,
+                               const float* velX, const float* velY, int count,
+                               float x, float y, float radius2,
+                               float& vX, float& vY, int& parts);
+
+
+inline void accumulateBlockScalar(const float* posX, const float* posY,
+                                  const float* velX, const float* velY, int count,
+                                  float x, float y, float radius2,
+                                  float& vX, float& vY, int& parts) {
+    for (int k = 0; k < count; k++) {
+        float dx = x - posX[k];
+        float dy = y - posY[k];
+        if (dx * dx + dy * dy <= radius2) {
+            vX += velX[k];
+            vY += velY[k];
+            ++parts;
+        }
+    }
+}
+
+
+// The same test on the candidates slots[0 .. count) of the arrays, for
+// neighbour lists; the candidates are gathered instead of read in a row
+typedef void (*NeighborListKernel)(const float* posX, const float* posY,
+                                   const float* velX, const float* velY, const int* slots, int count,
+                                   float x, float y, float radius2,
+                                   float& vX, float& vY, int& parts);
+
+
+inline void accumulateListScalar(const float* posX, const float* posY,
+                                 const float* velX, const float* velY, const int* slots, int count,
+                                 float x, float y, float radius2,
+                                 float& vX, float& vY, int& parts) {
+    for (int k = 0; k < count; k++) {
+        int t = slots[k];
+        float dx = x - posX[t];
+        float dy = y - posY[t];
+        if (dx * dx + dy * dy <= radius2) {
+            vX += velX[t];
+            vY += velY[t];
+            ++parts;
+        }
+    }
+}
+
+
+#ifdef VICSEK_X86_SIMD
+
+// Sum of the lanes as a shuffle tree, a serial loop over the lanes costs
+// more than the whole block test for the few candidates of a typical cell
+__attribute__((target("avx2")))
+inline float sumLanes(__m256 v) {
+    __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_add_ss(x, _mm_movehdup_ps(x));
+    return _mm_cvtss_f32(x);
+}
+
+__attribute__((target("avx512f")))
+inline float sumLanes(__m512 v) {
+    const __m512i upperHalf = _mm512_set_epi32(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    const __m512i upperQuarter = _mm512_set_epi32(11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4);
+    v = _mm512_add_ps(v, _mm512_mask_permutexvar_ps(v, 0xFFFF, upperHalf, v));
+    v = _mm512_add_ps(v, _mm512_mask_permutexvar_ps(v, 0xFFFF, upperQuarter, v));
+    __m128 x = _mm512_mask_extractf32x4_ps(_mm_setzero_ps(), 0xF, v, 0);
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_add_ss(x, _mm_movehdup_ps(x));
+    return _mm_cvtss_f32(x);
+}
+
+
+// 8 candidates per iteration, the remainder is done by the scalar loop.
+// No FMA so the distance test rounds exactly like the scalar version.
+__attribute__((target("avx2")))
+inline void accumulateBlockAVX2(const float* posX, const float* posY,
+                                const float* velX, const float* velY, int count,
+                                float x, float y, float radius2,
+                                float& vX, float& vY, int& parts) {
+    int k = 0;
+    if (count >= 8) {
+        const __m256 tx = _mm256_set1_ps(x);
+        const __m256 ty = _mm256_set1_ps(y);
+        const __m256 r2 = _mm256_set1_ps(radius2);
+        __m256 sumX = _mm256_setzero_ps();
+        __m256 sumY = _mm256_setzero_ps();
+        int found = 0;
+        for (; k + 8 <= count; k += 8) {
+            __m256 dx = _mm256_sub_ps(tx, _mm256_loadu_ps(posX + k));
+            __m256 dy = _mm256_sub_ps(ty, _mm256_loadu_ps(posY + k));
+            __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            __m256 mask = _mm256_cmp_ps(d2, r2, _CMP_LE_OQ);
+            sumX = _mm256_add_ps(sumX, _mm256_and_ps(mask, _mm256_loadu_ps(velX + k)));
+            sumY = _mm256_add_ps(sumY, _mm256_and_ps(mask, _mm256_loadu_ps(velY + k)));
+            found += __builtin_popcount(_mm256_movemask_ps(mask));
+        }
+        vX += sumLanes(sumX);
+        vY += sumLanes(sumY);
+        parts += found;
+    }
+    accumulateBlockScalar(posX + k, posY + k, velX + k, velY + k, count - k,
+                          x, y, radius2, vX, vY, parts);
+}
+
+
+// 16 candidates per iteration, the remainder uses a masked load
+__attribute__((target("avx512f")))
+inline void accumulateBlockAVX512(const float* posX, const float* posY,
+                                  const float* velX, const float* velY, int count,
+                                  float x, float y, float radius2,
+                                  float& vX, float& vY, int& parts) {
+    if (count == 0) return;
+    const __m512 tx = _mm512_set1_ps(x);
+    const __m512 ty = _mm512_set1_ps(y);
+    const __m512 r2 = _mm512_set1_ps(radius2);
+    __m512 sumX = _mm512_setzero_ps();
+    __m512 sumY = _mm512_setzero_ps();
+    int found = 0;
+
+    for (int k = 0; k < count; k += 16) {
+        __mmask16 valid = (count - k >= 16) ? __mmask16(0xFFFF) : __mmask16((1u << (count - k)) - 1);
+        __m512 dx = _mm512_sub_ps(tx, _mm512_maskz_loadu_ps(valid, posX + k));
+        __m512 dy = _mm512_sub_ps(ty, _mm512_maskz_loadu_ps(valid, posY + k));
+        __m512 d2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        __mmask16 mask = _mm512_mask_cmp_ps_mask(valid, d2, r2, _CMP_LE_OQ);
+        sumX = _mm512_mask_add_ps(sumX, mask, sumX, _mm512_maskz_loadu_ps(mask, velX + k));
+        sumY = _mm512_mask_add_ps(sumY, mask, sumY, _mm512_maskz_loadu_ps(mask, velY + k));
+        found += __builtin_popcount(mask);
+    }
+    if (found == 0) return;
+    vX += sumLanes(sumX);
+    vY += sumLanes(sumY);
+    parts += found;
+}
+
+
+__attribute__((target("avx2")))
+inline void accumulateListAVX2(const float* posX, const float* posY,
+                               const float* velX, const float* velY, const int* slots, int count,
+                               float x, float y, float radius2,
+                               float& vX, float& vY, int& parts) {
+    int k = 0;
+    if (count >= 8) {
+        const __m256 tx = _mm256_set1_ps(x);
+        const __m256 ty = _mm256_set1_ps(y);
+        const __m256 r2 = _mm256_set1_ps(radius2);
+        __m256 sumX = _mm256_setzero_ps();
+        __m256 sumY = _mm256_setzero_ps();
+        int found = 0;
+        for (; k + 8 <= count; k += 8) {
+            __m256i t = _mm256_loadu_si256((const __m256i*)(slots + k));
+            __m256 dx = _mm256_sub_ps(tx, _mm256_i32gather_ps(posX, t, 4));
+            __m256 dy = _mm256_sub_ps(ty, _mm256_i32gather_ps(posY, t, 4));
+            __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            __m256 mask = _mm256_cmp_ps(d2, r2, _CMP_LE_OQ);
+            sumX = _mm256_add_ps(sumX, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), velX, t, mask, 4));
+            sumY = _mm256_add_ps(sumY, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), velY, t, mask, 4));
+            found += __builtin_popcount(_mm256_movemask_ps(mask));
+        }
+        vX += sumLanes(sumX);
+        vY += sumLanes(sumY);
+        parts += found;
+    }
+    accumulateListScalar(posX, posY, velX, velY, slots + k, count - k,
+                         x, y, radius2, vX, vY, parts);
+}
+
+
+__attribute__((target("avx512f")))
+inline void accumulateListAVX512(const float* posX, const float* posY,
+                                 const float* velX, const float* velY, const int* slots, int count,
+                                 float x, float y, float radius2,
+                                 float& vX, float& vY, int& parts) {
+    if (count == 0) return;
+    const __m512 tx = _mm512_set1_ps(x);
+    const __m512 ty = _mm512_set1_ps(y);
+    const __m512 r2 = _mm512_set1_ps(radius2);
+    __m512 sumX = _mm512_setzero_ps();
+    __m512 sumY = _mm512_setzero_ps();
+    int found = 0;
+
+    for (int k = 0; k < count; k += 16) {
+        __mmask16 valid = (count - k >= 16) ? __mmask16(0xFFFF) : __mmask16((1u << (count - k)) - 1);
+        __m512i t = _mm512_maskz_loadu_epi32(valid, slots + k);
+        __m512 dx = _mm512_sub_ps(tx, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), valid, t, posX, 4));
+        __m512 dy = _mm512_sub_ps(ty, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), valid, t, posY, 4));
+        __m512 d2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        __mmask16 mask = _mm512_mask_cmp_ps_mask(valid, d2, r2, _CMP_LE_OQ);
+        sumX = _mm512_add_ps(sumX, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, t, velX, 4));
+        sumY = _mm512_add_ps(sumY, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, t, velY, 4));
+        found += __builtin_popcount(mask);
+    }
+    if (found == 0) return;
+    vX += sumLanes(sumX);
+    vY += sumLanes(sumY);
+    parts += found;
+}
+
+#endif
+
+
+// Kernel for the requested level, falling back to what the CPU supports
+inline NeighborKernel neighborKernelFor(SimdLevel level) {
+#ifdef VICSEK_X86_SIMD
+    bool avx512 = __builtin_cpu_supports("avx512f");
+    bool avx2 = __builtin_cpu_supports("avx2");
+    if (level == SimdLevel::Auto) {
+        level = avx512 ? SimdLevel::AVX512 : avx2 ? SimdLevel::AVX2 : SimdLevel::Scalar;
+    }
+    if (level == SimdLevel::AVX512 && avx512) return accumulateBlockAVX512;
+    if ((level == SimdLevel::AVX512 || level == SimdLevel::AVX2) && avx2) return accumulateBlockAVX2;
+#endif
+    return accumulateBlockScalar;
+}
+
+
+// Kernel used by the spatial indices, picked once from CPU features.
+// Can be overridden with setNeighborKernel (e.g. --simd scalar).
+inline NeighborKernel& activeNeighborKernel() {
+    static NeighborKernel kernel = neighborKernelFor(SimdLevel::Auto);
+    return kernel;
+}
+
+inline void setNeighborKernel(SimdLevel level) {
+    activeNeighborKernel() = neighborKernelFor(level);
+}
+
+// List kernel of the same instruction set as the active block kernel
+inline NeighborListKernel activeNeighborListKernel() {
+#ifdef VICSEK_X86_SIMD
+    if (activeNeighborKernel() == accumulateBlockAVX512) return accumulateListAVX512;
+    if (activeNeighborKernel() == accumulateBlockAVX2) return accumulateListAVX2;
+#endif
+    return accumulateListScalar;
+}
+
+inline const char* neighborKernelName() {
+#ifdef VICSEK_X86_SIMD
+    if (activeNeighborKernel() == accumulateBlockAVX512) return "avx512";
+    if (activeNeighborKernel() == accumulateBlockAVX2) return "avx2";
+#endif
+    return "scalar";
+}
@@ -0,0 +1,668 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cell_list.h"
+#include "fast_math.h"
+#include "morton.h"
+#include "noise.h"
+#include "profiler.h"
+#include "quadtree.h"
+#include "rng.h"
+
+
+// Spatial index used to find the neighbours of each particle
+enum class Engine {
+    CellList,       // Uniform grid with periodic cell wrap (default)
+    Quadtree,       // Pointer-based Quadtree rebuilt every step, with padding particles
+    FlatQuadtree,   // Arena-backed Quadtree built from Morton-sorted keys
+    BruteForce      // Every pair tested with the minimum image, O(N^2) reference
+};
+
+
+// Scalar measurements of the swarm after a step, computed inside the update loop
+struct Observables {
+    long step = 0;
+    double polarOrder = 0;          // v_a = |sum v_i| / (N v0), 1 = fully aligned
+    double meanHeading = 0;         // Angle of sum v_i
+    double meanNeighbors = 0;       // Average number of other particles within the radius
+};
+
+
+// Largest k of the topological rule, the k nearest are kept on the stack
+const int maxTopological = 64;
+
+
+// All parameters of a run, filled from defaults and command-line flags
+struct Params {
+    // Physics variables
+    float height = 900;
+    float width = 900;
+    float depth = 900;              // Only used with dimensions = 3
+    float radius = 2;               // Only used for drawing and initial margin
+    float velocity = 2;
+    int nParticles = 7000;
+
+    // Variables affecting behaviour
+    float noise = 0.7;
+    NoiseDistribution noiseDistribution = NoiseDistribution::Uniform;
+    float interactionRadius = 10;
+    int topological = 0;            // Align with the k nearest particles instead, 0 = metric rule
+    float skin = 0;                 // Verlet lists of radius + skin reused across steps, 0 = off (cells only)
+
+    // Run control
+    unsigned int seed = 0;
+    bool randomSeed = true;         // Seed from std::random_device unless --seed is given
+    long steps = 0;                 // 0 means run until 'q' is pressed (window mode)
+    bool headless = false;          // Run without any SDL calls
+    int renderEvery = 1;            // Steps between two frames handed to the window
+    int windowSize = 0;             // Longest window side in pixels, 0 = box size
+    int dotRadius = 0;              // Drawn particle radius in pixels, 0 = one pixel
+    bool drawHeadings = false;      // Heading lines coloured by angle
+    Engine engine = Engine::CellList;
+    int reorderEvery = 0;           // Sort particles by Morton key every K steps, 0 = never
+    bool fastMath = false;          // Polynomial sincos/atan2 heading update instead of libm
+    bool compact = false;           // 16-bit quantized state (CompactSimulation), headless only
+    int dimensions = 2;             // 3 runs Swarm<3> (src/swarm.h), headless only
+
+    // Output
+    std::string trajectoryPath;     // Binary trajectory file, empty = none
+    int trajectoryEvery = 1;        // Steps between two trajectory frames
+    int observeEvery = 0;           // Log observables every K steps, 0 = never
+    std::string observePath;        // Observables log file, empty = standard output
+    std::string checkpointPath;     // Checkpoint file, empty = none
+    int checkpointEvery = 0;        // Steps between checkpoints, 0 = only at the end of a headless run
+    std::string restartPath;        // Resume from this checkpoint
+    std::string exportPath;         // Movie file (.y4m, .gif or PPM pattern), empty = none
+    int exportEvery = 1;            // Steps between two movie frames
+    int exportFps = 30;             // Playback rate stored in the movie
+    bool profile = false;           // Time the phases of every frame from the start
+    std::string profilePath;        // Per-frame timings, .json for JSON, otherwise CSV
+};
+
+
+// Why the Verlet skin does not fit the rest of params, NULL if it does.
+// Checked on the command line and again after a checkpoint replaced the
+// engine and rule, since the skin itself is not stored. Lists are only
+// allowed where they were measured to pay: they must live at least 5 steps
+// and hold few particles, past about 25 neighbours the SIMD scan of the
+// cells is as fast as the gathers of the list walk.
+inline const char* verletConflict(const Params& params) {
+    if (params.skin < 0 || (params.skin > 0 && (params.engine != Engine::CellList || params.topological > 0))) {
+        return "verlet needs the cells engine and the metric rule";
+    }
+    if (params.skin > 0 && 2 * (params.interactionRadius + params.skin) > std::min(params.width, params.height)) {
+        return "verlet needs a box of at least twice radius + skin";
+    }
+    if (params.skin > 0 && params.skin < 10 * params.velocity) {
+        return "verlet needs a skin of at least 10 v0, lists rebuilt more often cost more than they save";
+    }
+    float neighbors = params.nParticles / (params.width * params.height) *
+                      3.14159f * params.interactionRadius * params.interactionRadius;
+    if (params.skin > 0 && neighbors > 25) {
+        return "verlet only pays below about 25 neighbours per particle, plain cells are faster here";
+    }
+    return NULL;
+}
+
+
+// Random start shared by all engines: picks the seed if params asks for a
+// random one, then calls visit(i, x, y, angle) for every particle in order
+template <typename Visitor>
+void initialState(Params& params, Visitor&& visit) {
+    if (params.randomSeed) {
+        std::random_device rand_dev;
+        params.seed = rand_dev();
+        params.randomSeed = false;      // Copies of params reuse the drawn seed
+    }
+    std::mt19937 generator(params.seed);
+
+    std::uniform_real_distribution<float>  xRand(params.radius*2, params.width-params.radius*2);
+    std::uniform_real_distribution<float>  yRand(params.radius*2, params.height-params.radius*2);
+    float pi = 3.14159;
+    std::uniform_real_distribution<float>  thetaRand(-pi, pi);
+
+    for (int i = 0; i<params.nParticles; i++){
+        float x = xRand(generator);
+        float y = yRand(generator);
+        float angle = thetaRand(generator);
+        visit(i, x, y, angle);
+    }
+}
+
+
+// The swarm state and one Vicsek update step. Holds no SDL state so it can
+// be driven both by the window loop and by the headless batch loop.
+// The particle update runs in parallel with OpenMP; noise comes from a
+// counter-based generator so results do not depend on the thread count.
+class Simulation {
+public:
+    Params params;
+    long iteration = 0;
+
+    // Our swarm arrays
+    std::vector<float> posX, posY, velX, velY, angles;
+    std::vector<int> ids;           // Particle id of each slot, changes only when reordering
+    Observables observables;        // Measured during the last step
+    Profiler profiler;              // Phase timings, off unless enabled
+
+    Simulation(const Params& params_): params(params_) {
+        int n = params.nParticles;
+        posX.resize(n);
+        posY.resize(n);
+        velX.resize(n);
+        velY.resize(n);
+        angles.resize(n);
+        ids.resize(n);
+        initialState(params, [&](int i, float x, float y, float angle) {
+            ids[i] = i;
+            posX[i] = x;
+            posY[i] = y;
+            angles[i] = angle;
+            velX[i]=params.velocity*std::cos(angles[i]);
+            velY[i]=params.velocity*std::sin(angles[i]);
+        });
+
+        newPosX.resize(n);
+        newPosY.resize(n);
+        newVelX.resize(n);
+        newVelY.resize(n);
+        newAngles.resize(n);
+        neighborCount.resize(n);
+    }
+
+    // Move all particles one time step
+    void step() {
+        const int nParticles = params.nParticles;
+        const float width = params.width;
+        const float height = params.height;
+        const float velocity = params.velocity;
+        const float noise = params.noise;
+        const float interactionRadius = params.interactionRadius;
+        const float inRadiusSquared = interactionRadius*interactionRadius;
+        const Engine engine = params.engine;
+        const bool fastMath = params.fastMath;
+        const int topological = params.topological;
+        const bool verlet = params.skin > 0 && engine == Engine::CellList && topological == 0;
+
+        const uint64_t seed = params.seed;
+        const uint64_t step = iteration;
+
+        if (params.reorderEvery > 0 && iteration % params.reorderEvery == 0) {
+            ScopedTimer timer(profiler, Phase::Reorder);
+            reorder();
+        }
+        const bool rebuildList = verlet && neighborListExpired();
+
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i<nParticles; i++){
+            newPosX[i] = posX[i];
+            newPosY[i] = posY[i];
+        }
+        if (engine == Engine::Quadtree) {
+            ScopedTimer timer(profiler, Phase::Padding);
+            for (int i = 0; i<nParticles; i++){
+                fillPadding(posXPad, posYPad, anglePad, posX[i], posY[i], angles[i], width, height, interactionRadius);
+            }
+        }
+
+        // Define the quadtree boundary
+        float halfWidth = width/2.0f;
+        float halfHeight = height/2.0f;
+        Quadtree::Boundary boundary = {halfWidth, halfHeight, halfWidth, halfHeight};
+        Quadtree tree(boundary, 8); // Set capacity per node
+
+        {
+            ScopedTimer timer(profiler, Phase::Build);
+            if (engine == Engine::CellList) {
+                // Periodic wrap is done by the grid itself, no padding needed.
+                // For the topological rule the radius plays no part; cells
+                // holding about k+1 particles keep the ring search short.
+                float cellSize = topological > 0 ?
+                    std::sqrt(width * height * (topological + 1) / nParticles) : interactionRadius;
+                if (verlet) {
+                    // Grid and lists are only needed when the lists expire
+                    if (rebuildList) {
+                        cells.build(posX.data(), posY.data(), velX.data(), velY.data(),
+                                    nParticles, width, height, interactionRadius + params.skin);
+                        buildNeighborList(interactionRadius + params.skin);
+                    }
+                    gatherListSlots();
+                } else if (CellList::updatePays(velocity, cellSize)) {
+                    cells.update(posX.data(), posY.data(), velX.data(), velY.data(),
+                                 nParticles, width, height, cellSize);
+                } else {
+                    cells.build(posX.data(), posY.data(), velX.data(), velY.data(),
+                                nParticles, width, height, cellSize);
+                }
+            } else if (engine == Engine::FlatQuadtree) {
+                flatTree.build(posX.data(), posY.data(), velX.data(), velY.data(),
+                               nParticles, width, height);
+            } else if (engine == Engine::Quadtree) {
+                // Insert points into the Quadtree
+                for (int i = 0; i < nParticles; ++i) {
+                    tree.insert({posX[i], posY[i], i});
+                }
+                for (int i = 0; i < posXPad.size(); ++i) {
+                    tree.insert({posXPad[i], posYPad[i], -1}); // Use -1 or similar for padding points
+                }
+            }
+        }
+
+        {
+            ScopedTimer timer(profiler, Phase::Noise);
+            fillNoise(newAngles.data(), ids.data(), nParticles, seed, step, noise, params.noiseDistribution);
+        }
+
+        // Sums for the observables, reduced across threads. Doubles keep the
+        // result stable to well below float precision whatever the thread count.
+        double sumVelX = 0, sumVelY = 0, sumParts = 0;
+
+        // Sum the velocities around each particle. The sums and the neighbour
+        // count are kept for the update pass below, next to the noise angle.
+        {
+            ScopedTimer timer(profiler, Phase::Query);
+            #pragma omp parallel for schedule(static) reduction(+:sumParts)
+            for (int k = 0; k<nParticles; k++){
+                // Verlet lists are walked in their cell order
+                const int i = verlet ? listOrder[k] : k;
+                float vX = 0.0f, vY = 0.0f;
+                int parts = 0;
+
+                std::vector<int> neighbors;
+                if (topological > 0) {
+                    // The particle itself is its own nearest, so k+1 are searched
+                    int slot[maxTopological + 1];
+                    float dist2[maxTopological + 1];
+                    parts = cells.nearest(posX[i], posY[i], topological + 1, slot, dist2);
+                    for (int j = 0; j < parts; j++) {
+                        vX += cells.velX[slot[j]];
+                        vY += cells.velY[slot[j]];
+                    }
+                } else if (verlet) {
+                    listAccumulate(k, inRadiusSquared, vX, vY, parts);
+                } else if (engine == Engine::CellList) {
+                    cells.accumulate(posX[i], posY[i], inRadiusSquared, vX, vY, parts);
+                } else if (engine == Engine::FlatQuadtree) {
+                    flatTree.accumulate(posX[i], posY[i], interactionRadius, vX, vY, parts);
+                } else if (engine == Engine::BruteForce) {
+                    bruteForceAccumulate(posX[i], posY[i], interactionRadius, vX, vY, parts);
+                } else {
+                    tree.query(posX[i], posY[i], interactionRadius, neighbors);
+                }
+
+                // Process neighbors
+                for (int idx : neighbors) {
+                    if (idx >= 0) { // Regular particle
+                        vX += velX[idx];
+                        vY += velY[idx];
+                    } else { // Padding particle
+                        int padIdx = -(idx + 1);
+                        vX += velocity * std::cos(anglePad[padIdx]);
+                        vY += velocity * std::sin(anglePad[padIdx]);
+                    }
+                    ++parts;
+                }
+
+                sumParts += parts;
+                newVelX[i] = vX;
+                newVelY[i] = vY;
+                neighborCount[i] = parts;
+            }
+        }
+
+        {
+            ScopedTimer timer(profiler, Phase::Update);
+            if (!fastMath) {
+                // Update particle velocity and position
+                #pragma omp parallel for schedule(static) reduction(+:sumVelX,sumVelY)
+                for (int i = 0; i<nParticles; i++){
+                    float vX = newVelX[i];
+                    float vY = newVelY[i];
+                    int parts = neighborCount[i];
+                    if (parts > 0) {
+                        vX /= (velocity * parts);
+                        vY /= (velocity * parts);
+                    }
+                    float newAngle = std::atan2(vY, vX) + newAngles[i];
+
+                    newVelX[i] = velocity * std::cos(newAngle);
+                    newVelY[i] = velocity * std::sin(newAngle);
+                    newAngles[i] = newAngle;
+                    sumVelX += newVelX[i];
+                    sumVelY += newVelY[i];
+
+                    newPosX[i] += newVelX[i];
+                    newPosY[i] += newVelY[i];
+
+                    // Periodic boundary, x and y are wrapped independently
+                    newPosX[i] = wrap(newPosX[i], width);
+                    newPosY[i] = wrap(newPosY[i], height);
+                }
+            } else {
+                // Trig-free update: normalise the mean direction to a unit heading
+                // and rotate it by the noise angle. Branch-free, so it vectorizes.
+                // Work is split into fixed chunks with a float sum each, which
+                // vectorizes where a double reduction in the simd loop does not.
+                const int chunk = 1024;
+                const int nChunks = (nParticles + chunk - 1) / chunk;
+                #pragma omp parallel for schedule(static) reduction(+:sumVelX,sumVelY)
+                for (int c0 = 0; c0 < nChunks; c0++){
+                    int first = c0 * chunk;
+                    int last = std::min(first + chunk, nParticles);
+                    float chunkVelX = 0, chunkVelY = 0;
+                    #pragma omp simd reduction(+:chunkVelX,chunkVelY)
+                    for (int i = first; i<last; i++){
+                        float vX = newVelX[i];
+                        float vY = newVelY[i];
+                        float length2 = vX*vX + vY*vY;
+                        float inverse = 1.0f / std::sqrt(std::max(length2, 1e-30f));
+                        float headX = length2 > 0 ? vX * inverse : 1.0f;    // atan2(0, 0) = 0
+                        float headY = vY * inverse;
+
+                        float s, c;
+                        fastSinCos(newAngles[i], s, c);
+                        float newHeadX = headX*c - headY*s;
+                        float newHeadY = headX*s + headY*c;
+
+                        newVelX[i] = velocity * newHeadX;
+                        newVelY[i] = velocity * newHeadY;
+                        newAngles[i] = fastAtan2(newHeadY, newHeadX);
+                        chunkVelX += newVelX[i];
+                        chunkVelY += newVelY[i];
+
+                        newPosX[i] = wrap(newPosX[i] + newVelX[i], width);
+                        newPosY[i] = wrap(newPosY[i] + newVelY[i], height);
+                    }
+                    sumVelX += chunkVelX;
+                    sumVelY += chunkVelY;
+                }
+            }
+        }
+
+        std::swap(posX, newPosX);
+        std::swap(posY, newPosY);
+        std::swap(velX, newVelX);
+        std::swap(velY, newVelY);
+        std::swap(angles, newAngles);
+
+        if (profiler.enabled) {
+            profiler.frame.ghosts = posXPad.size();
+            profiler.frame.treeDepth = engine == Engine::FlatQuadtree ? flatTree.depth :
+                                       engine == Engine::Quadtree ? tree.depth() : 0;
+        }
+        posXPad.clear();
+        posYPad.clear();
+        anglePad.clear();
+        iteration++;
+        listAge++;
+
+        observables.step = iteration;
+        observables.polarOrder = std::sqrt(sumVelX*sumVelX + sumVelY*sumVelY) / (nParticles * velocity);
+        observables.meanHeading = std::atan2(sumVelY, sumVelX);
+        observables.meanNeighbors = sumParts / nParticles - 1;     // parts includes the particle itself
+        profiler.frame.meanNeighbors = observables.meanNeighbors;
+    }
+
+    // Sort all particle arrays along a Z-order curve so that particles close
+    // in space are close in memory, which keeps the neighbour gathers in
+    // cache. Noise is keyed on ids and follows the particles, but the
+    // neighbour sums are added in the new slot order, so the floats differ
+    // from a run without reordering; a fixed interval is reproducible.
+    void reorder() {
+        int n = params.nParticles;
+        sortKeys.resize(n);
+        sortOrder.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i<n; i++){
+            sortKeys[i] = mortonKey(posX[i], posY[i], params.width, params.height);
+            sortOrder[i] = i;
+        }
+        radixSortByKey(sortKeys, sortOrder, sortKeysTmp, sortOrderTmp);
+
+        // The new* arrays are free between steps, use them as scratch
+        permute(posX, newPosX);
+        permute(posY, newPosY);
+        permute(velX, newVelX);
+        permute(velY, newVelY);
+        permute(angles, newAngles);
+        sortIds.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i<n; i++){
+            sortIds[i] = ids[sortOrder[i]];
+        }
+        std::swap(ids, sortIds);
+        cells.invalidate(); // The grid and the lists hold the old indices
+        listAge = -1;
+    }
+
+    // Exact reference search: every particle is tested against (x, y) and
+    // against its periodic images that lie within radius of the box.
+    // Assumes radius <= half the box size, like the other engines.
+    void bruteForceAccumulate(float x, float y, float radius, float& vX, float& vY, int& parts) const {
+        float imagesX[2] = {x, x};
+        float imagesY[2] = {y, y};
+        int nX = 1, nY = 1;
+        if (x < radius) imagesX[nX++] = x + params.width;
+        else if (x > params.width - radius) imagesX[nX++] = x - params.width;
+        if (y < radius) imagesY[nY++] = y + params.height;
+        else if (y > params.height - radius) imagesY[nY++] = y - params.height;
+
+        NeighborKernel kernel = activeNeighborKernel();
+        for (int iy = 0; iy < nY; iy++) {
+            for (int ix = 0; ix < nX; ix++) {
+                kernel(posX.data(), posY.data(), velX.data(), velY.data(), params.nParticles,
+                       imagesX[ix], imagesY[iy], radius * radius, vX, vY, parts);
+            }
+        }
+    }
+
+    // Build the Verlet lists again in the next step, as a restart from the
+    // current state does, so both continue bit-exactly
+    void resetNeighborLists() {
+        listAge = -1;
+    }
+
+    // Neighbours summed per slot in the last step, the particle itself included
+    const std::vector<int>& neighborCounts() const {
+        return neighborCount;
+    }
+
+private:
+    // Map a coordinate that moved at most one box length back into [0, length)
+    static float wrap(float x, float length) {
+        return x >= length ? x - length : (x < 0 ? x + length : x);
+    }
+
+    // Verlet lists in CSR form over the cell order of the last build: the
+    // slots within radius + skin of slot s are listNeighbors[listStart[s] ..
+    // listStart[s+1]), itself included, in the order the grid visits them.
+    // They come in segments of one periodic shift each, segment g ending at
+    // listSegmentEnd[g] with the shift (listShiftX[g], listShiftY[g]) of its
+    // cells; slot s has the segments listSegmentStart[s] .. listSegmentStart[s+1].
+    // Positions and velocities are gathered into that slot order every step
+    // so the list walks stay local.
+    std::vector<int> listStart, listNeighbors;
+    std::vector<int> listSegmentStart, listSegmentEnd;
+    std::vector<float> listShiftX, listShiftY;
+    std::vector<int> listOrder;             // Particle of each slot
+    std::vector<float> listX, listY;        // Positions at the last build, by particle
+    std::vector<float> slotX, slotY, slotVelX, slotVelY;
+    long listAge = -1;                      // Steps since the last build, -1 = no lists
+
+    // A pair gets closer by at most twice the largest displacement since the
+    // build, so the lists hold every pair within the radius until that
+    // exceeds the skin. Particles move v0 per step, so nothing needs checking
+    // while 2 v0 steps stays below the skin; after that the measured
+    // displacement decides.
+    bool neighborListExpired() const {
+        if (listAge < 0) return true;
+        if (2 * params.velocity * listAge <= params.skin) return false;
+        const float width = params.width, height = params.height;
+        float maxShift2 = 0;
+        #pragma omp parallel for schedule(static) reduction(max:maxShift2)
+        for (int i = 0; i<params.nParticles; i++){
+            float dx = minimumImage(posX[i] - listX[i], width);
+            float dy = minimumImage(posY[i] - listY[i], height);
+            maxShift2 = std::max(maxShift2, dx*dx + dy*dy);
+        }
+        return 4 * maxShift2 > params.skin * params.skin;
+    }
+
+    // Call segment(shiftX, shiftY) whenever the periodic shift changes and
+    // visit(first, last, x, y) for the slot range of every cell around slot,
+    // with the target shifted to that cell, in the order of
+    // CellList::forEachNeighborCell
+    template <typename Segment, typename Visitor>
+    void forEachListCell(int slot, Segment&& segment, Visitor&& visit) const {
+        const float x = cells.posX[slot], y = cells.posY[slot];
+        bool first = true;
+        float lastShiftX = 0, lastShiftY = 0;
+        cells.forEachNeighborCell(x, y, [&](int begin, int end, float shiftX, float shiftY) {
+            if (first || shiftX != lastShiftX || shiftY != lastShiftY) {
+                segment(shiftX, shiftY);
+                first = false;
+                lastShiftX = shiftX;
+                lastShiftY = shiftY;
+            }
+            visit(begin, end, x - shiftX, y - shiftY);
+        });
+    }
+
+    // The distance test of both build passes, so they agree on every entry
+    static bool inList(const float* posX, const float* posY, int t, float x, float y, float listRadius2) {
+        float dx = x - posX[t], dy = y - posY[t];
+        return dx*dx + dy*dy <= listRadius2;
+    }
+
+    // Count pass, prefix sums, fill pass, straight into the CSR arrays.
+    // Both passes test without branches: the fill writes every candidate
+    // and only advances past those inside.
+    // cells must have been built with a cell size of at least listRadius.
+    void buildNeighborList(float listRadius) {
+        const int n = params.nParticles;
+        const float listRadius2 = listRadius * listRadius;
+        const float* cellX = cells.posX.data();
+        const float* cellY = cells.posY.data();
+        listStart.resize(n + 1);
+        listSegmentStart.resize(n + 1);
+        listStart[0] = 0;
+        listSegmentStart[0] = 0;
+        #pragma omp parallel for schedule(static)
+        for (int slot = 0; slot < n; slot++) {
+            int entries = 0, segments = 0;
+            forEachListCell(slot, [&](float, float) { segments++; }, [&](int first, int last, float x, float y) {
+                for (int t = first; t < last; t++) entries += inList(cellX, cellY, t, x, y, listRadius2);
+            });
+            listStart[slot + 1] = entries;
+            listSegmentStart[slot + 1] = segments;
+        }
+        for (int slot = 0; slot < n; slot++) {
+            listStart[slot + 1] += listStart[slot];
+            listSegmentStart[slot + 1] += listSegmentStart[slot];
+        }
+        listNeighbors.resize(listStart[n]);
+        listSegmentEnd.resize(listSegmentStart[n]);
+        listShiftX.resize(listSegmentStart[n]);
+        listShiftY.resize(listSegmentStart[n]);
+        #pragma omp parallel
+        {
+            std::vector<int> row;
+            #pragma omp for schedule(static)
+            for (int slot = 0; slot < n; slot++) {
+                int out = listStart[slot], g = listSegmentStart[slot];
+                forEachListCell(slot, [&](float shiftX, float shiftY) {
+                    if (g > listSegmentStart[slot]) listSegmentEnd[g - 1] = out;
+                    listShiftX[g] = shiftX;
+                    listShiftY[g] = shiftY;
+                    g++;
+                }, [&](int first, int last, float x, float y) {
+                    // Straight into the list while every candidate fits
+                    // before the next slot's row, else through the scratch row
+                    int room = listStart[slot + 1] - out;
+                    int* to = last - first <= room ? listNeighbors.data() + out : (row.resize(last - first), row.data());
+                    int found = 0;
+                    for (int t = first; t < last; t++) {
+                        to[found] = t;
+                        found += inList(cellX, cellY, t, x, y, listRadius2);
+                    }
+                    found = std::min(found, room);
+                    if (to == row.data()) std::copy(row.begin(), row.begin() + found, listNeighbors.begin() + out);
+                    out += found;
+                });
+                listSegmentEnd[g - 1] = out;
+            }
+        }
+
+        listOrder = cells.index;
+        listX = posX;
+        listY = posY;
+        listAge = 0;
+    }
+
+    // Current positions and velocities in the slot order of the lists.
+    // Positions are unwrapped from the ones at the build, so the shifts of
+    // the segments still hold for particles that crossed the box edge since.
+    void gatherListSlots() {
+        const int n = params.nParticles;
+        const float width = params.width, height = params.height;
+        slotX.resize(n);
+        slotY.resize(n);
+        slotVelX.resize(n);
+        slotVelY.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int slot = 0; slot < n; slot++) {
+            int i = listOrder[slot];
+            slotX[slot] = listX[i] + minimumImage(posX[i] - listX[i], width);
+            slotY[slot] = listY[i] + minimumImage(posY[i] - listY[i], height);
+            slotVelX[slot] = velX[i];
+            slotVelY[slot] = velY[i];
+        }
+    }
+
+    // Same sums as CellList::accumulate over the candidates of the list,
+    // one kernel call per segment with the target shifted like there
+    void listAccumulate(int slot, float radius2, float& vX, float& vY, int& parts) const {
+        NeighborListKernel kernel = activeNeighborListKernel();
+        const float x = slotX[slot], y = slotY[slot];
+        int first = listStart[slot];
+        for (int g = listSegmentStart[slot]; g < listSegmentStart[slot + 1]; g++) {
+            kernel(slotX.data(), slotY.data(), slotVelX.data(), slotVelY.data(), listNeighbors.data() + first,
+                   listSegmentEnd[g] - first, x - listShiftX[g], y - listShiftY[g], radius2, vX, vY, parts);
+            first = listSegmentEnd[g];
+        }
+    }
+
+    // Difference of two coordinates in [0, length) as the nearest periodic image
+    static float minimumImage(float d, float length) {
+        return d > length / 2 ? d - length : (d < -length / 2 ? d + length : d);
+    }
+
+    // Buffers for reorder()
+    std::vector<uint32_t> sortKeys, sortKeysTmp;
+    std::vector<int> sortOrder, sortOrderTmp, sortIds;
+
+    void permute(std::vector<float>& values, std::vector<float>& scratch) {
+        int n = params.nParticles;
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i<n; i++){
+            scratch[i] = values[sortOrder[i]];
+        }
+        std::swap(values, scratch);
+    }
+
+    // Attributes of updated particles
+    std::vector<float> newPosX, newPosY, newVelX, newVelY, newAngles;
+    std::vector<int> neighborCount;
+
+    // Padding (for interactions thorugh boundary)
+    std::vector<float> posXPad, posYPad, anglePad;
+
+    // Spatial indices, reused between steps so their buffers are only allocated once
+    CellList cells;
+    FlatQuadtree flatTree;
+};
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "rng.h"
+#include "simulation.h"
+
+
+// Vicsek model in three dimensions, behind --dimensions 3. The particle
+// store, the cell grid and the update kernel are templates on D, so every
+// loop over the axes has a compile-time trip count and unrolls, but only D = 3
+// is instantiated: 2D runs go through Simulation, with its SIMD kernels,
+// Morton reordering and fast-math update, and there is no second 2D engine.
+// The only dimension-specific code is how a heading is drawn and perturbed,
+// in HeadingRule<3> below.
+
+
+// Box side along each axis, from width, height and depth
+template <int D>
+std::array<float, D> boxOf(const Params& params) {
+    const float sides[3] = {params.width, params.height, params.depth};
+    std::array<float, D> box;
+    for (int d = 0; d < D; d++) box[d] = sides[d];
+    return box;
+}
+
+
+template <int D>
+struct HeadingRule;
+
+// The mean direction turned by a random vector uniform on the spherical cap
+// of half-angle noise / 2 around it, so noise = 2 pi is a uniform direction
+// like in 2D
+template <>
+struct HeadingRule<3> {
+    struct Step {
+        uint64_t seed, step;
+        float capHeight;                // 1 - cos of the cap half-angle
+        Step(const Params& params, uint64_t step_):
+            seed(params.seed), step(step_), capHeight(1 - std::cos(std::min(params.noise, 6.2831853f) / 2)) {}
+    };
+
+    static void initial(std::mt19937& generator, float* heading) {
+        std::uniform_real_distribution<float> zRand(-1, 1);
+        std::uniform_real_distribution<float> phiRand(-3.14159f, 3.14159f);
+        float z = zRand(generator);
+        float phi = phiRand(generator);
+        float r = std::sqrt(std::max(0.0f, 1 - z * z));
+        heading[0] = r * std::cos(phi);
+        heading[1] = r * std::sin(phi);
+        heading[2] = z;
+    }
+
+    static void turn(const Step& s, uint32_t id, const float* sum, float* heading) {
+        float norm = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+        // Headings that cancel exactly point along x, like atan2(0, 0) = 0 in 2D
+        float u[3] = {1, 0, 0};
+        if (norm > 0) {
+            u[0] = sum[0] / norm;
+            u[1] = sum[1] / norm;
+            u[2] = sum[2] / norm;
+        }
+        // Two unit vectors normal to u, from the axis least aligned with it
+        float a[3] = {0, 0, 0};
+        a[std::fabs(u[0]) < 0.9f ? 0 : 1] = 1;
+        float e1[3] = {a[1] * u[2] - a[2] * u[1], a[2] * u[0] - a[0] * u[2], a[0] * u[1] - a[1] * u[0]};
+        float e1Norm = std::sqrt(e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2]);
+        for (int d = 0; d < 3; d++) e1[d] /= e1Norm;
+        float e2[3] = {u[1] * e1[2] - u[2] * e1[1], u[2] * e1[0] - u[0] * e1[2], u[0] * e1[1] - u[1] * e1[0]};
+
+        // cos(theta) uniform in [1 - capHeight, 1] is uniform on the cap's area
+        Philox4x32 r(s.seed, s.step, id);
+        float cosTheta = 1 - toUnitFloat(r.v[0]) * s.capHeight;
+        float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+        float phi = toUnitFloat(r.v[1]) * 6.2831853f;
+        float c = sinTheta * std::cos(phi), t = sinTheta * std::sin(phi);
+        for (int d = 0; d < 3; d++) {
+            heading[d] = cosTheta * u[d] + c * e1[d] + t * e2[d];
+        }
+    }
+};
+
+
+// Periodic grid of cells with side >= the interaction radius along every
+// axis, rebuilt each step by a counting sort like CellList. Positions and
+// headings are gathered into cell order.
+template <int D>
+class CellGrid {
+public:
+    std::array<int, D> cells;       // Number of cells along each axis
+    std::array<float, D> cellSize, box;
+
+    std::vector<int> cellStart;     // First slot of each cell, size nCells+1
+    std::vector<int> index;         // Particle index of each slot
+    std::array<std::vector<float>, D> pos, heading;     // In cell order
+
+    void build(const std::array<std::vector<float>, D>& x, const std::array<std::vector<float>, D>& h,
+               int n, const std::array<float, D>& box_, float radius) {
+        box = box_;
+        int nCells = 1;
+        for (int d = 0; d < D; d++) {
+            cells[d] = std::max(1, int(box[d] / radius));
+            cellSize[d] = box[d] / cells[d];
+            nCells *= cells[d];
+        }
+        cellStart.assign(nCells + 1, 0);
+        cellOf.resize(n);
+        index.resize(n);
+        for (int d = 0; d < D; d++) {
+            pos[d].resize(n);
+            heading[d].resize(n);
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            float p[D];
+            for (int d = 0; d < D; d++) p[d] = x[d][i];
+            cellOf[i] = cellId(p);
+        }
+        for (int i = 0; i < n; i++) {
+            cellStart[cellOf[i] + 1]++;
+        }
+        for (int c = 0; c < nCells; c++) {
+            cellStart[c + 1] += cellStart[c];
+        }
+        fill.assign(cellStart.begin(), cellStart.end() - 1);
+        for (int i = 0; i < n; i++) {
+            index[fill[cellOf[i]]++] = i;
+        }
+        #pragma omp parallel for schedule(static)
+        for (int slot = 0; slot < n; slot++) {
+            int i = index[slot];
+            for (int d = 0; d < D; d++) {
+                pos[d][slot] = x[d][i];
+                heading[d][slot] = h[d][i];
+            }
+        }
+    }
+
+    int cellId(const float* p) const {
+        int id = 0;
+        for (int d = D - 1; d >= 0; d--) {
+            id = id * cells[d] + std::min(std::max(int(p[d] / cellSize[d]), 0), cells[d] - 1);
+        }
+        return id;
+    }
+
+    // Sum the headings of all particles within radius of p, itself included.
+    // Visits the 3^D cells around p; as in CellList, an axis with fewer than
+    // three cells visits a cell once per periodic image.
+    void accumulate(const float* p, float radius2, float* sum, int& parts) const {
+        int home[D];
+        for (int d = 0; d < D; d++) {
+            home[d] = std::min(std::max(int(p[d] / cellSize[d]), 0), cells[d] - 1);
+        }
+        int rows = 1;
+        for (int d = 1; d < D; d++) rows *= 3;
+        for (int k = 0; k < rows; k++) {
+            // Offset k of the axes above 0 in base 3; the target is moved to
+            // the periodic image of the row instead of the candidates
+            int row = 0, stride = cells[0], code = k;
+            float target[D];
+            target[0] = p[0];
+            for (int d = 1; d < D; d++) {
+                int c = home[d] + code % 3 - 1;
+                code /= 3;
+                target[d] = p[d];
+                if (c < 0) { c += cells[d]; target[d] += box[d]; }
+                else if (c >= cells[d]) { c -= cells[d]; target[d] -= box[d]; }
+                row += c * stride;
+                stride *= cells[d];
+            }
+            if (home[0] >= 1 && home[0] + 1 < cells[0]) {
+                // The three cells along axis 0 are contiguous in cell order
+                accumulateCells(cellStart[row + home[0] - 1], cellStart[row + home[0] + 2], target, radius2, sum, parts);
+                continue;
+            }
+            for (int o = -1; o <= 1; o++) {
+                int c = home[0] + o;
+                target[0] = p[0];
+                if (c < 0) { c += cells[0]; target[0] += box[0]; }
+                else if (c >= cells[0]) { c -= cells[0]; target[0] -= box[0]; }
+                accumulateCells(cellStart[row + c], cellStart[row + c + 1], target, radius2, sum, parts);
+            }
+        }
+    }
+
+private:
+    std::vector<int> cellOf;
+    std::vector<int> fill;
+
+    void accumulateCells(int first, int last, const float* target, float radius2, float* sum, int& parts) const {
+        const float* px[D];
+        const float* hx[D];
+        for (int d = 0; d < D; d++) {
+            px[d] = pos[d].data();
+            hx[d] = heading[d].data();
+        }
+        float blockSum[D] = {};
+        int found = 0;
+        #pragma omp simd reduction(+:blockSum[:D],found)
+        for (int slot = first; slot < last; slot++) {
+            float d2 = 0;
+            for (int d = 0; d < D; d++) {
+                float delta = target[d] - px[d][slot];
+                d2 += delta * delta;
+            }
+            // 0/1 factor instead of a branch so the loop vectorizes
+            float inside = d2 <= radius2 ? 1.0f : 0.0f;
+            for (int d = 0; d < D; d++) blockSum[d] += inside * hx[d][slot];
+            found += int(inside);
+        }
+        for (int d = 0; d < D; d++) sum[d] += blockSum[d];
+        parts += found;
+    }
+};
+
+
+template <int D>
+class Swarm {
+    static_assert(D == 3, "2D runs use Simulation; Swarm is the 3D engine");
+
+public:
+    Params params;
+    long iteration = 0;
+
+    std::array<std::vector<float>, D> pos;      // Positions, one array per axis
+    std::array<std::vector<float>, D> heading;  // Unit heading vectors
+    std::vector<int> ids;
+    Observables observables;        // Measured during the last step; the mean
+                                    // heading is the angle in the x-y plane
+
+    Swarm(const Params& params_): params(params_) {
+        int n = params.nParticles;
+        for (int d = 0; d < D; d++) {
+            pos[d].resize(n);
+            heading[d].resize(n);
+        }
+        ids.resize(n);
+        initialize();
+    }
+
+    void step() {
+        const int nParticles = params.nParticles;
+        const std::array<float, D> box = boxOf<D>(params);
+        const float velocity = params.velocity;
+        const float radius2 = params.interactionRadius * params.interactionRadius;
+        const typename HeadingRule<D>::Step rule(params, iteration);
+
+        grid.build(pos, heading, nParticles, box, params.interactionRadius);
+
+        // Particles are visited in cell order, so neighbouring targets read
+        // the same cells; the result goes back to the particle's own index
+        double sumHeading[D] = {};
+        double sumParts = 0;
+        #pragma omp parallel for schedule(static) reduction(+:sumHeading[:D],sumParts)
+        for (int slot = 0; slot < nParticles; slot++) {
+            const int i = grid.index[slot];
+            float p[D], sum[D] = {}, h[D];
+            for (int d = 0; d < D; d++) p[d] = grid.pos[d][slot];
+            int parts = 0;
+            grid.accumulate(p, radius2, sum, parts);
+            HeadingRule<D>::turn(rule, ids[i], sum, h);
+            for (int d = 0; d < D; d++) {
+                float x = p[d] + velocity * h[d];
+                pos[d][i] = x >= box[d] ? x - box[d] : (x < 0 ? x + box[d] : x);
+                heading[d][i] = h[d];
+                sumHeading[d] += h[d];
+            }
+            sumParts += parts;
+        }
+        iteration++;
+
+        double norm2 = 0;
+        for (int d = 0; d < D; d++) norm2 += sumHeading[d] * sumHeading[d];
+        observables.step = iteration;
+        observables.polarOrder = std::sqrt(norm2) / nParticles;
+        observables.meanHeading = std::atan2(sumHeading[1], sumHeading[0]);
+        observables.meanNeighbors = sumParts / nParticles - 1;     // parts includes the particle itself
+    }
+
+private:
+    CellGrid<D> grid;
+
+    // Random start like initialState(): uniform positions with the drawing
+    // margin, then a heading uniform on the sphere, drawn per particle in order
+    void initialize() {
+        if (params.randomSeed) {
+            std::random_device rand_dev;
+            params.seed = rand_dev();
+            params.randomSeed = false;
+        }
+        std::mt19937 generator(params.seed);
+        const std::array<float, D> box = boxOf<D>(params);
+        std::uniform_real_distribution<float> axisRand[D];
+        for (int d = 0; d < D; d++) {
+            axisRand[d] = std::uniform_real_distribution<float>(params.radius*2, box[d]-params.radius*2);
+        }
+        for (int i = 0; i < params.nParticles; i++) {
+            for (int d = 0; d < D; d++) pos[d][i] = axisRand[d](generator);
+            float h[D];
+            HeadingRule<D>::initial(generator, h);
+            for (int d = 0; d < D; d++) heading[d][i] = h[d];
+            ids[i] = i;
+        }
+    }
+};
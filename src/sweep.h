@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simulation.h"
+#include "thread_pool.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+// Grid of parameter points for --sweep. An empty list keeps the value from
+// the base Params; density is particles per unit area in the given box.
+struct SweepParams {
+    bool enabled = false;
+    std::vector<float> noise, density, radius;
+    int replicas = 1;               // Independent seeds per point
+    long burnIn = 0;                // Steps before measuring starts
+    int workers = 0;                // Worker threads, 0 = all cores
+    std::string outputPath;         // Results table, empty = standard output
+};
+
+
+// Read "a,b,c" or "start:stop:step" into values, returns false on bad input
+inline bool parseList(const char* text, std::vector<float>& values) {
+    values.clear();
+    char* end;
+    float first = std::strtof(text, &end);
+    if (end == text) return false;
+    if (*end == ':') {
+        const char* rest = end + 1;
+        float stop = std::strtof(rest, &end);
+        if (end == rest || *end != ':') return false;
+        rest = end + 1;
+        float step = std::strtof(rest, &end);
+        if (end == rest || *end != '\0' || step <= 0) return false;
+        // Count the points instead of accumulating, so the last one is not lost to rounding
+        int count = int(std::floor((stop - first) / step + 1e-4f)) + 1;
+        for (int k = 0; k < count; k++) {
+            values.push_back(first + k * step);
+        }
+        return !values.empty();
+    }
+    values.push_back(first);
+    while (*end == ',') {
+        const char* rest = end + 1;
+        values.push_back(std::strtof(rest, &end));
+        if (end == rest) return false;
+    }
+    return *end == '\0';
+}
+
+
+// Time-averaged observables of one replica
+struct ReplicaResult {
+    double polarOrder = 0;          // <v_a>
+    double polarOrder2 = 0;         // <v_a^2>
+    double meanNeighbors = 0;
+};
+
+
+// Run every (noise, density, radius) point of the grid with several seeds on
+// a work-stealing pool, one single-threaded simulation per task, and write
+// one row per point averaged over time and replicas.
+inline int runSweep(Params base, const SweepParams& sweep) {
+    if (base.randomSeed) {
+        std::random_device rand_dev;
+        base.seed = rand_dev();
+        base.randomSeed = false;
+    }
+    std::vector<float> noises = sweep.noise.empty() ? std::vector<float>{base.noise} : sweep.noise;
+    std::vector<float> radii = sweep.radius.empty() ? std::vector<float>{base.interactionRadius} : sweep.radius;
+    std::vector<float> densities = sweep.density;
+    if (densities.empty()) densities.push_back(base.nParticles / (base.width * base.height));
+    long steps = base.steps > 0 ? base.steps : 1000;
+
+    std::vector<Params> points;
+    for (float density : densities) {
+        for (float radius : radii) {
+            for (float noise : noises) {
+                Params p = base;
+                p.noise = noise;
+                p.interactionRadius = radius;
+                p.nParticles = std::max(1, int(std::lround(density * base.width * base.height)));
+                // The command line only saw the base radius
+                if (const char* conflict = verletConflict(p)) {
+                    std::cerr << "--" << conflict << " (sweep radius " << radius << ")\n";
+                    return 1;
+                }
+                points.push_back(p);
+            }
+        }
+    }
+
+    // One task per replica, biggest first so the pool can balance the tail
+    struct Task {
+        int point, replica;
+        double cost;
+    };
+    std::vector<Task> tasks;
+    for (int pt = 0; pt < int(points.size()); pt++) {
+        const Params& p = points[pt];
+        double neighbors = p.nParticles / (p.width * p.height) * 3.14159 * p.interactionRadius * p.interactionRadius;
+        double cost = double(p.nParticles) * (sweep.burnIn + steps) * (1 + neighbors);
+        for (int r = 0; r < sweep.replicas; r++) {
+            tasks.push_back({pt, r, cost});
+        }
+    }
+    std::stable_sort(tasks.begin(), tasks.end(), [](const Task& a, const Task& b) { return a.cost > b.cost; });
+
+    int workers = sweep.workers > 0 ? sweep.workers : std::max(1u, std::thread::hardware_concurrency());
+    WorkStealingPool pool(workers);
+    std::vector<ReplicaResult> results(points.size() * sweep.replicas);
+    std::mutex progressMutex;
+    int done = 0;
+
+    for (const Task& task : tasks) {
+        pool.submit([&, task](int) {
+#ifdef _OPENMP
+            // Replicas are the unit of parallelism, keep each one on its own thread
+            omp_set_num_threads(1);
+#endif
+            Params p = points[task.point];
+            p.seed = base.seed + uint64_t(task.point) * sweep.replicas + task.replica;
+            Simulation sim(p);
+            for (long s = 0; s < sweep.burnIn; s++) {
+                sim.step();
+            }
+            ReplicaResult result;
+            for (long s = 0; s < steps; s++) {
+                sim.step();
+                result.polarOrder += sim.observables.polarOrder;
+                result.polarOrder2 += sim.observables.polarOrder * sim.observables.polarOrder;
+                result.meanNeighbors += sim.observables.meanNeighbors;
+            }
+            result.polarOrder /= steps;
+            result.polarOrder2 /= steps;
+            result.meanNeighbors /= steps;
+            results[task.point * sweep.replicas + task.replica] = result;
+
+            std::lock_guard<std::mutex> lock(progressMutex);
+            done++;
+            std::cerr << "\rsweep: " << done << "/" << tasks.size() << " replicas done" << std::flush;
+        });
+    }
+    pool.run();
+    std::cerr << "\n";
+
+    std::ofstream file;
+    if (!sweep.outputPath.empty()) {
+        file.open(sweep.outputPath);
+        if (!file) {
+            std::cerr << "Could not open sweep output " << sweep.outputPath << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = file.is_open() ? file : std::cout;
+
+    // Error is the standard error over replicas, susceptibility is N (<v_a^2> - <v_a>^2)
+    out << "noise,density,radius,particles,replicas,polar_order,polar_order_err,susceptibility,mean_neighbors\n";
+    for (int pt = 0; pt < int(points.size()); pt++) {
+        const Params& p = points[pt];
+        double mean = 0, mean2 = 0, chi = 0, neighbors = 0;
+        for (int r = 0; r < sweep.replicas; r++) {
+            const ReplicaResult& result = results[pt * sweep.replicas + r];
+            mean += result.polarOrder;
+            mean2 += result.polarOrder * result.polarOrder;
+            chi += p.nParticles * (result.polarOrder2 - result.polarOrder * result.polarOrder);
+            neighbors += result.meanNeighbors;
+        }
+        int R = sweep.replicas;
+        mean /= R;
+        mean2 /= R;
+        double err = R > 1 ? std::sqrt(std::max(0.0, mean2 - mean * mean) / (R - 1)) : 0.0;
+        out << p.noise << "," << p.nParticles / (p.width * p.height) << "," << p.interactionRadius << ","
+            << p.nParticles << "," << R << "," << mean << "," << err << ","
+            << chi / R << "," << neighbors / R << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of independent tasks run by a pool of worker threads. Every
+// worker has its own deque and takes tasks from its front; a worker whose
+// deque is empty steals from the back of another one. Submit the tasks in
+// decreasing cost order so big jobs start first and the small ones at the
+// back are what gets stolen to even out the tail.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int nWorkers): queues(nWorkers > 0 ? nWorkers : 1) {}
+
+    int workers() const {
+        return queues.size();
+    }
+
+    // Deal tasks round-robin over the workers, call before run()
+    void submit(std::function<void(int worker)> task) {
+        Queue& queue = queues[next++ % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    // Run all submitted tasks and return when they are done
+    void run() {
+        std::vector<std::thread> threads;
+        for (int w = 1; w < workers(); w++) {
+            threads.emplace_back(&WorkStealingPool::work, this, w);
+        }
+        work(0);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void(int)>> tasks;
+    };
+    std::vector<Queue> queues;
+    size_t next = 0;
+
+    bool popOwn(int worker, std::function<void(int)>& task) {
+        Queue& queue = queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(int worker, std::function<void(int)>& task) {
+        for (int k = 1; k < workers(); k++) {
+            Queue& victim = queues[(worker + k) % workers()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tasks.empty()) continue;
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    // No task creates new tasks, so once every deque is empty we are done
+    void work(int worker) {
+        std::function<void(int)> task;
+        while (popOwn(worker, task) || steal(worker, task)) {
+            task(worker);
+        }
+    }
+};
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simulation.h"
+
+
+// Binary trajectory file, all values little-endian as written by the host:
+//   TrajectoryHeader
+//   frames:  TrajectoryFrameHeader, posX[n], posY[n], angles[n] (float, by particle id)
+//   index:   uint64 offset of every frame
+//   TrajectoryTrailer
+// Frames are self-describing, so a file cut short by a crash can still be
+// read sequentially; the index at the end gives random access to frame k.
+
+struct TrajectoryHeader {
+    char magic[8];                  // "VICSEKTJ"
+    uint32_t version;
+    uint32_t nParticles;
+    float width, height;
+    float velocity, noise;
+    float interactionRadius;
+    float reserved0;
+    uint64_t seed;
+    uint32_t frameEvery;            // Steps between two frames
+    uint32_t reserved1;
+};
+static_assert(sizeof(TrajectoryHeader) == 56, "TrajectoryHeader must have no padding");
+
+struct TrajectoryFrameHeader {
+    char tag[4];                    // "FRAM"
+    uint32_t nParticles;
+    uint64_t step;
+};
+static_assert(sizeof(TrajectoryFrameHeader) == 16, "TrajectoryFrameHeader must have no padding");
+
+struct TrajectoryTrailer {
+    uint64_t indexOffset;
+    uint64_t frameCount;
+    char magic[8];                  // "VTJINDEX"
+};
+static_assert(sizeof(TrajectoryTrailer) == 24, "TrajectoryTrailer must have no padding");
+
+
+// One frame of particle state, indexed by particle id
+struct Snapshot {
+    uint64_t step = 0;
+    std::vector<float> posX, posY, angles;
+
+    void capture(const Simulation& sim) {
+        int n = sim.params.nParticles;
+        posX.resize(n);
+        posY.resize(n);
+        angles.resize(n);
+        step = sim.iteration;
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i<n; i++){
+            int id = sim.ids[i];
+            posX[id] = sim.posX[i];
+            posY[id] = sim.posY[i];
+            angles[id] = sim.angles[i];
+        }
+    }
+};
+
+
+// Hands the newest state from the simulation thread to the render thread
+// with three snapshot buffers: one being filled, one ready, one being drawn.
+// Neither side ever waits for the other; frames the renderer was too slow
+// to pick up are simply overwritten.
+class LatestSnapshot {
+public:
+    // Simulation side: copy the state and make it the newest one
+    void publish(const Simulation& sim) {
+        filling->capture(sim);
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(filling, ready);
+        fresh = true;
+    }
+
+    // Render side: switch to the newest snapshot, false if there is none since the last call
+    bool acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!fresh) return false;
+        std::swap(drawing, ready);
+        fresh = false;
+        return true;
+    }
+
+    const Snapshot& current() const {
+        return *drawing;
+    }
+
+private:
+    Snapshot buffers[3];
+    Snapshot* filling = &buffers[0];
+    Snapshot* ready = &buffers[1];
+    Snapshot* drawing = &buffers[2];
+    std::mutex mutex;
+    bool fresh = false;
+};
+
+
+// Writes frames from a background thread. submit() copies the state into one
+// of two snapshot buffers and returns; it only waits when both buffers are
+// still queued, i.e. when the disk is slower than the simulation.
+class TrajectoryWriter {
+public:
+    ~TrajectoryWriter() {
+        close();
+    }
+
+    bool open(const std::string& path, const Params& params, int frameEvery) {
+        file = fopen(path.c_str(), "wb");
+        if (file == NULL) {
+            std::cerr << "Could not open trajectory file " << path << "\n";
+            return false;
+        }
+        TrajectoryHeader header = {};
+        memcpy(header.magic, "VICSEKTJ", 8);
+        header.version = 1;
+        header.nParticles = params.nParticles;
+        header.width = params.width;
+        header.height = params.height;
+        header.velocity = params.velocity;
+        header.noise = params.noise;
+        header.interactionRadius = params.interactionRadius;
+        header.seed = params.seed;
+        header.frameEvery = frameEvery;
+        fwrite(&header, sizeof(header), 1, file);
+
+        offsets.clear();
+        queued.clear();
+        stopping = false;
+        failed = false;
+        idle = {&buffers[0], &buffers[1]};
+        worker = std::thread(&TrajectoryWriter::run, this);
+        return true;
+    }
+
+    bool isOpen() const {
+        return file != NULL;
+    }
+
+    void submit(const Simulation& sim) {
+        Snapshot* snapshot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]{ return !idle.empty(); });
+            snapshot = idle.back();
+            idle.pop_back();
+        }
+        snapshot->capture(sim);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(snapshot);
+        }
+        changed.notify_all();
+    }
+
+    // Flush queued frames, write the index and close the file
+    void close() {
+        if (file == NULL) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        worker.join();
+
+        TrajectoryTrailer trailer = {};
+        trailer.indexOffset = ftell(file);
+        trailer.frameCount = offsets.size();
+        memcpy(trailer.magic, "VTJINDEX", 8);
+        fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file);
+        fwrite(&trailer, sizeof(trailer), 1, file);
+        if (fclose(file) != 0 || failed) {
+            std::cerr << "Error while writing trajectory file\n";
+        }
+        file = NULL;
+    }
+
+private:
+    FILE* file = NULL;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable changed;
+    Snapshot buffers[2];
+    std::vector<Snapshot*> idle, queued;
+    std::vector<uint64_t> offsets;      // Only touched by the worker until it is joined
+    bool stopping = false;
+    bool failed = false;
+
+    void run() {
+        while (true) {
+            Snapshot* snapshot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]{ return stopping || !queued.empty(); });
+                if (queued.empty()) return;
+                snapshot = queued.front();
+                queued.erase(queued.begin());
+            }
+            write(*snapshot);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.push_back(snapshot);
+            }
+            changed.notify_all();
+        }
+    }
+
+    void write(const Snapshot& snapshot) {
+        uint32_t n = snapshot.posX.size();
+        TrajectoryFrameHeader frame = {};
+        memcpy(frame.tag, "FRAM", 4);
+        frame.nParticles = n;
+        frame.step = snapshot.step;
+        offsets.push_back(ftell(file));
+        size_t written = fwrite(&frame, sizeof(frame), 1, file);
+        written += fwrite(snapshot.posX.data(), sizeof(float), n, file);
+        written += fwrite(snapshot.posY.data(), sizeof(float), n, file);
+        written += fwrite(snapshot.angles.data(), sizeof(float), n, file);
+        if (written != 1 + 3*size_t(n)) failed = true;
+    }
+};
+
+
+// Random access to the frames of a trajectory file. Every frame holds
+// header.nParticles particles; the header, the index and each frame are
+// checked against the file size before anything is sized from them.
+class TrajectoryReader {
+public:
+    TrajectoryHeader header = {};
+    std::vector<uint64_t> offsets;      // File offset of each frame
+
+    ~TrajectoryReader() {
+        if (file != NULL) fclose(file);
+    }
+
+    bool open(const std::string& path) {
+        file = fopen(path.c_str(), "rb");
+        if (file == NULL) return false;
+        if (fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(header.magic, "VICSEKTJ", 8) != 0 || header.version != 1) {
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        uint64_t size = ftell(file);
+        frameBytes = sizeof(TrajectoryFrameHeader) + 3*sizeof(float)*uint64_t(header.nParticles);
+
+        // Use the index if the file was closed properly, otherwise scan the frames
+        TrajectoryTrailer trailer = {};
+        if (size >= sizeof(header) + sizeof(trailer)) {
+            fseek(file, -long(sizeof(trailer)), SEEK_END);
+            if (fread(&trailer, sizeof(trailer), 1, file) == 1 &&
+                memcmp(trailer.magic, "VTJINDEX", 8) == 0) {
+                return readIndex(trailer, size);
+            }
+        }
+        for (uint64_t offset = sizeof(header); offset + frameBytes <= size; offset += frameBytes) {
+            offsets.push_back(offset);
+        }
+        return true;
+    }
+
+    int frameCount() const {
+        return offsets.size();
+    }
+
+    bool readFrame(int k, Snapshot& snapshot) {
+        if (k < 0 || k >= frameCount()) return false;
+        TrajectoryFrameHeader frame;
+        fseek(file, offsets[k], SEEK_SET);
+        if (fread(&frame, sizeof(frame), 1, file) != 1 || memcmp(frame.tag, "FRAM", 4) != 0 ||
+            frame.nParticles != header.nParticles) {
+            return false;
+        }
+        uint32_t n = frame.nParticles;
+        snapshot.step = frame.step;
+        snapshot.posX.resize(n);
+        snapshot.posY.resize(n);
+        snapshot.angles.resize(n);
+        size_t read = fread(snapshot.posX.data(), sizeof(float), n, file);
+        read += fread(snapshot.posY.data(), sizeof(float), n, file);
+        read += fread(snapshot.angles.data(), sizeof(float), n, file);
+        return read == 3*size_t(n);
+    }
+
+private:
+    FILE* file = NULL;
+    uint64_t frameBytes = 0;
+
+    // The index must sit between the header and the trailer, and every frame it
+    // points to must fit in front of it
+    bool readIndex(const TrajectoryTrailer& trailer, uint64_t size) {
+        uint64_t indexEnd = size - sizeof(trailer);
+        if (trailer.indexOffset < sizeof(header) || trailer.indexOffset > indexEnd ||
+            trailer.frameCount != (indexEnd - trailer.indexOffset) / sizeof(uint64_t) ||
+            (indexEnd - trailer.indexOffset) % sizeof(uint64_t) != 0) {
+            return false;
+        }
+        offsets.resize(trailer.frameCount);
+        fseek(file, trailer.indexOffset, SEEK_SET);
+        if (fread(offsets.data(), sizeof(uint64_t), offsets.size(), file) != offsets.size()) {
+            return false;
+        }
+        for (uint64_t offset : offsets) {
+            if (offset < sizeof(header) || offset > trailer.indexOffset ||
+                trailer.indexOffset - offset < frameBytes) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
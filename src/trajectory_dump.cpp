@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+#include "trajectory.h"
+
+
+// Reads a trajectory file written with --trajectory back through
+// TrajectoryReader: lists the frames with their polar order parameter, or
+// prints one frame as CSV (id,x,y,angle) by particle id.
+
+
+void printUsage(const char* prog){
+    std::cerr << "Usage: " << prog << " <file.vtj> [--frame <k>]\n"
+              << "  without --frame     list every frame with its step and order parameter\n"
+              << "  --frame <k>         print frame k as CSV, negative k counts from the end\n";
+}
+
+
+int main(int argc, char * argv[]){
+    if (argc != 2 && !(argc == 4 && std::string(argv[2]) == "--frame")) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    TrajectoryReader reader;
+    if (!reader.open(argv[1])) {
+        std::cerr << argv[1] << ": not a trajectory file or damaged\n";
+        return 1;
+    }
+    const TrajectoryHeader& header = reader.header;
+    Snapshot snapshot;
+
+    if (argc == 4) {
+        char* end;
+        long k = strtol(argv[3], &end, 10);
+        if (*end != '\0') {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (k < 0) k += reader.frameCount();
+        if (k < 0 || k >= reader.frameCount() || !reader.readFrame(k, snapshot)) {
+            std::cerr << argv[1] << ": no readable frame " << argv[3] << "\n";
+            return 1;
+        }
+        std::cout.precision(9);
+        std::cout << "id,x,y,angle\n";
+        for (uint32_t i = 0; i<header.nParticles; i++){
+            std::cout << i << "," << snapshot.posX[i] << "," << snapshot.posY[i] << "," << snapshot.angles[i] << "\n";
+        }
+        return 0;
+    }
+
+    std::cout << header.nParticles << " particles, box " << header.width << " x " << header.height
+              << ", v0 " << header.velocity << ", noise " << header.noise
+              << ", r " << header.interactionRadius << ", seed " << header.seed
+              << ", every " << header.frameEvery << " steps, " << reader.frameCount() << " frames\n";
+    std::cout << "frame step order\n";
+    for (int k = 0; k<reader.frameCount(); k++){
+        if (!reader.readFrame(k, snapshot)) {
+            std::cerr << argv[1] << ": frame " << k << " is damaged\n";
+            return 1;
+        }
+        double sumX = 0, sumY = 0;
+        for (float angle : snapshot.angles) {
+            sumX += std::cos(angle);
+            sumY += std::sin(angle);
+        }
+        double order = header.nParticles > 0 ? std::sqrt(sumX*sumX + sumY*sumY) / header.nParticles : 0;
+        std::cout << k << " " << snapshot.step << " " << order << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cell_list.h"
+#include "compact.h"
+#include "quadtree.h"
+#include "simulation.h"
+
+
+// Options of --validate
+struct ValidateParams {
+    std::vector<std::string> engines;   // Checked against the brute-force oracle, empty = off
+    std::string outputPath;             // Per-particle mismatches (CSV), empty = none
+    float tolerance = 1e-3f;            // Heading error counted as a mismatch, radians
+};
+
+
+// Engines --validate can check
+inline bool validationEngine(const std::string& name) {
+    return name == "quadtree" || name == "flat-quadtree" || name == "cells" ||
+           name == "fast-math" || name == "compact";
+}
+
+
+// Differences of one engine from the oracle, summed over the checked steps
+struct ValidationReport {
+    std::string engine;
+    long checked = 0;               // Particle-steps compared
+    long setMismatches = 0;         // Particle-steps whose neighbour set differs
+    long countMismatches = 0;       // Particle-steps whose count in the engine's own step differs
+    bool countChecked = false;      // The engine reported its counts (not the 16-bit one)
+    long missing = 0;               // Oracle neighbours the engine did not see
+    long extra = 0;                 // Neighbours the engine saw beyond the oracle, duplicates included
+    long misdecoded = 0;            // Quadtree ghost hits whose velocity is read from ghost 0
+    long headingMismatches = 0;     // Particle-steps with heading error above the tolerance
+    double maxHeadingError = 0;
+    double sumHeadingError2 = 0;
+};
+
+
+// Neighbour multiset of every particle (particle indices, sorted, the
+// particle itself included) as each engine defines it, from one state.
+// The index engines are walked through their own cells, leaves and ghosts
+// but with a scalar distance test, and the 16-bit one by brute force on its
+// quantized state; what the kernels of the real step see is checked through
+// the neighbour counts of stepFrom.
+class NeighborSets {
+public:
+    std::vector<std::vector<int>> sets;
+    long misdecoded = 0;
+
+    // Exact search, the arithmetic of Simulation::bruteForceAccumulate: the
+    // target and its images within radius of the box against every particle
+    void bruteForce(const Simulation& sim) {
+        const Params& params = sim.params;
+        const int n = params.nParticles;
+        const float radius = params.interactionRadius;
+        const float radius2 = radius * radius;
+        reset(n);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (int i = 0; i < n; i++) {
+            float x = sim.posX[i], y = sim.posY[i];
+            float imagesX[2] = {x, x};
+            float imagesY[2] = {y, y};
+            int nX = 1, nY = 1;
+            if (x < radius) imagesX[nX++] = x + params.width;
+            else if (x > params.width - radius) imagesX[nX++] = x - params.width;
+            if (y < radius) imagesY[nY++] = y + params.height;
+            else if (y > params.height - radius) imagesY[nY++] = y - params.height;
+            for (int iy = 0; iy < nY; iy++) {
+                for (int ix = 0; ix < nX; ix++) {
+                    for (int j = 0; j < n; j++) {
+                        float dx = imagesX[ix] - sim.posX[j];
+                        float dy = imagesY[iy] - sim.posY[j];
+                        if (dx * dx + dy * dy <= radius2) sets[i].push_back(j);
+                    }
+                }
+            }
+            std::sort(sets[i].begin(), sets[i].end());
+        }
+    }
+
+    // The 3x3 cells around each particle, shifted images as in CellList::accumulate
+    void cellList(const Simulation& sim) {
+        const Params& params = sim.params;
+        const int n = params.nParticles;
+        const float radius2 = params.interactionRadius * params.interactionRadius;
+        CellList cells;
+        cells.build(sim.posX.data(), sim.posY.data(), sim.velX.data(), sim.velY.data(),
+                    n, params.width, params.height, params.interactionRadius);
+        reset(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            float x = sim.posX[i], y = sim.posY[i];
+            cells.forEachNeighborCell(x, y, [&](int first, int last, float shiftX, float shiftY) {
+                for (int slot = first; slot < last; slot++) {
+                    float dx = (x - shiftX) - cells.posX[slot];
+                    float dy = (y - shiftY) - cells.posY[slot];
+                    if (dx * dx + dy * dy <= radius2) sets[i].push_back(cells.index[slot]);
+                }
+            });
+            std::sort(sets[i].begin(), sets[i].end());
+        }
+    }
+
+    void flatQuadtree(const Simulation& sim) {
+        const Params& params = sim.params;
+        const int n = params.nParticles;
+        FlatQuadtree tree;
+        tree.build(sim.posX.data(), sim.posY.data(), sim.velX.data(), sim.velY.data(),
+                   n, params.width, params.height);
+        reset(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            tree.query(sim.posX[i], sim.posY[i], params.interactionRadius, [&](int slot) {
+                sets[i].push_back(tree.index[slot]);
+            });
+            std::sort(sets[i].begin(), sets[i].end());
+        }
+    }
+
+    // The pointer Quadtree with fillPadding ghosts, built like Simulation
+    // does. The engine inserts every ghost with index -1 and reads its
+    // velocity from ghost 0; here ghost g gets -(g+1) so each hit can be
+    // traced to the particle it copies, and hits on g > 0 are counted as
+    // misdecoded.
+    void quadtree(const Simulation& sim) {
+        const Params& params = sim.params;
+        const int n = params.nParticles;
+        std::vector<float> padX, padY, padAngle;
+        std::vector<int> padSource;
+        for (int i = 0; i < n; i++) {
+            fillPadding(padX, padY, padAngle, sim.posX[i], sim.posY[i], sim.angles[i],
+                        params.width, params.height, params.interactionRadius);
+            padSource.resize(padX.size(), i);
+        }
+        float halfWidth = params.width / 2.0f, halfHeight = params.height / 2.0f;
+        Quadtree tree({halfWidth, halfHeight, halfWidth, halfHeight}, 8);
+        for (int i = 0; i < n; i++) {
+            tree.insert({sim.posX[i], sim.posY[i], i});
+        }
+        for (size_t g = 0; g < padX.size(); g++) {
+            tree.insert({padX[g], padY[g], -int(g + 1)});
+        }
+        reset(n);
+        misdecoded = 0;
+        #pragma omp parallel for schedule(static) reduction(+:misdecoded)
+        for (int i = 0; i < n; i++) {
+            std::vector<int> found;
+            tree.query(sim.posX[i], sim.posY[i], params.interactionRadius, found);
+            for (int idx : found) {
+                if (idx >= 0) {
+                    sets[i].push_back(idx);
+                } else {
+                    int g = -(idx + 1);
+                    sets[i].push_back(padSource[g]);
+                    misdecoded += g != 0;
+                }
+            }
+            std::sort(sets[i].begin(), sets[i].end());
+        }
+    }
+
+    // Brute force on the 16-bit state of CompactSimulation, with its
+    // int16 minimum image and distance test
+    void compact(const Simulation& sim) {
+        const Params& params = sim.params;
+        const int n = params.nParticles;
+        const float scaleX = params.width / 65536.0f, scaleY = params.height / 65536.0f;
+        const float radius2 = params.interactionRadius * params.interactionRadius;
+        std::vector<uint16_t> qx(n), qy(n);
+        for (int i = 0; i < n; i++) {
+            qx[i] = uint16_t(std::lrint(sim.posX[i] / params.width * 65536.0f));
+            qy[i] = uint16_t(std::lrint(sim.posY[i] / params.height * 65536.0f));
+        }
+        reset(n);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                float dx = int16_t(uint16_t(qx[j] - qx[i])) * scaleX;
+                float dy = int16_t(uint16_t(qy[j] - qy[i])) * scaleY;
+                if (dx * dx + dy * dy <= radius2) sets[i].push_back(j);
+            }
+        }
+    }
+
+private:
+    void reset(int n) {
+        sets.assign(n, std::vector<int>());
+    }
+};
+
+
+// Headings of all particles by id after one step of the engine, started
+// from the oracle's state at the oracle's step, so both draw the same noise.
+// counts gets the neighbours the step itself summed per particle, through
+// the engine's kernel; the 16-bit engine does not keep them and leaves it empty.
+inline std::vector<float> stepFrom(const Simulation& oracle, const std::string& engine, std::vector<int>& counts) {
+    Params params = oracle.params;
+    params.fastMath = engine == "fast-math";
+    params.engine = engine == "quadtree" ? Engine::Quadtree :
+                    engine == "flat-quadtree" ? Engine::FlatQuadtree : Engine::CellList;
+    std::vector<float> angles;
+    if (engine == "compact") {
+        CompactSimulation sim(params);
+        sim.pack(oracle.posX.data(), oracle.posY.data(), oracle.angles.data());
+        sim.iteration = oracle.iteration;
+        sim.step();
+        std::vector<float> x, y;
+        sim.unpack(x, y, angles);
+        counts.clear();
+        return angles;
+    }
+    Simulation sim(params);
+    sim.posX = oracle.posX;
+    sim.posY = oracle.posY;
+    sim.velX = oracle.velX;
+    sim.velY = oracle.velY;
+    sim.angles = oracle.angles;
+    sim.ids = oracle.ids;
+    sim.iteration = oracle.iteration;
+    sim.step();
+    counts = sim.neighborCounts();
+    return sim.angles;
+}
+
+
+// Run the brute-force engine for params.steps steps (10 if 0) and before
+// every step check each engine against it from the same state: neighbour
+// sets per particle, then the neighbour count and heading after one step. The oracle never
+// reorders, so slot i holds particle i throughout.
+inline int runValidation(Params params, const ValidateParams& validate) {
+    params.engine = Engine::BruteForce;
+    params.fastMath = false;
+    params.reorderEvery = 0;
+    long steps = params.steps > 0 ? params.steps : 10;
+    Simulation oracle(params);
+    const int n = params.nParticles;
+
+    std::ofstream out;
+    if (!validate.outputPath.empty()) {
+        out.open(validate.outputPath);
+        if (!out) {
+            std::cerr << "Could not open " << validate.outputPath << "\n";
+            return 1;
+        }
+        out << "step,engine,id,oracle_neighbors,engine_neighbors,step_neighbors,missing,extra,heading_error\n";
+    }
+
+    std::vector<ValidationReport> reports;
+    for (const std::string& engine : validate.engines) {
+        reports.push_back(ValidationReport());
+        reports.back().engine = engine;
+    }
+    NeighborSets truth, found;
+    std::vector<int> missing, extra, counts;
+    for (long s = 0; s < steps; s++) {
+        truth.bruteForce(oracle);
+        Simulation next = oracle;
+        next.step();
+        for (ValidationReport& report : reports) {
+            const std::string& engine = report.engine;
+            found.misdecoded = 0;
+            if (engine == "quadtree") found.quadtree(oracle);
+            else if (engine == "flat-quadtree") found.flatQuadtree(oracle);
+            else if (engine == "compact") found.compact(oracle);
+            else found.cellList(oracle);         // fast-math searches like cells
+            report.misdecoded += found.misdecoded;
+            std::vector<float> angles = stepFrom(oracle, engine, counts);
+            report.countChecked = report.countChecked || !counts.empty();
+
+            for (int i = 0; i < n; i++) {
+                const std::vector<int>& a = truth.sets[i];
+                const std::vector<int>& b = found.sets[i];
+                missing.clear();
+                extra.clear();
+                std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(missing));
+                std::set_difference(b.begin(), b.end(), a.begin(), a.end(), std::back_inserter(extra));
+                double error = std::fabs(std::remainder(double(angles[i]) - next.angles[i], 6.283185307179586));
+                bool setMismatch = !missing.empty() || !extra.empty();
+                bool countMismatch = !counts.empty() && counts[i] != int(a.size());
+                bool headingMismatch = error > validate.tolerance;
+                report.checked++;
+                report.setMismatches += setMismatch;
+                report.countMismatches += countMismatch;
+                report.missing += missing.size();
+                report.extra += extra.size();
+                report.headingMismatches += headingMismatch;
+                report.maxHeadingError = std::max(report.maxHeadingError, error);
+                report.sumHeadingError2 += error * error;
+                if (out.is_open() && (setMismatch || countMismatch || headingMismatch)) {
+                    out << oracle.iteration << "," << engine << "," << i << "," << a.size() << ","
+                        << b.size() << "," << (counts.empty() ? -1 : counts[i]) << ","
+                        << missing.size() << "," << extra.size() << "," << error << "\n";
+                }
+            }
+        }
+        oracle = std::move(next);
+    }
+
+    std::cout << "validated " << steps << " steps of " << n << " particles against brute force"
+              << " (seed " << oracle.params.seed << ", heading tolerance " << validate.tolerance << " rad)\n"
+              << std::left << std::setw(14) << "engine" << std::right
+              << std::setw(12) << "set-diff" << std::setw(10) << "missing" << std::setw(10) << "extra"
+              << std::setw(12) << "count-diff"
+              << std::setw(12) << "misdecoded" << std::setw(12) << "heading>tol"
+              << std::setw(12) << "max-err" << std::setw(12) << "rms-err" << "\n";
+    bool exact = true;
+    for (const ValidationReport& report : reports) {
+        std::cout << std::left << std::setw(14) << report.engine << std::right
+                  << std::setw(12) << report.setMismatches << std::setw(10) << report.missing
+                  << std::setw(10) << report.extra << std::setw(12)
+                  << (report.countChecked ? std::to_string(report.countMismatches) : "-")
+                  << std::setw(12) << report.misdecoded
+                  << std::setw(12) << report.headingMismatches
+                  << std::setw(12) << std::setprecision(3) << report.maxHeadingError
+                  << std::setw(12) << std::sqrt(report.sumHeadingError2 / report.checked) << "\n";
+        exact = exact && report.setMismatches == 0 && report.countMismatches == 0 &&
+                report.headingMismatches == 0;
+    }
+    return exact ? 0 : 2;
+}
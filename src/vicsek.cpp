@@ -0,0 +1,255 @@
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+
+#include "checkpoint.h"
+#include "simulation.h"
+#include "vicsek.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+// The handle behind the C API: parameters until the first step, then the
+// Simulation they create
+struct vicsek_sim {
+    Params params;
+    std::unique_ptr<Simulation> sim;
+    std::string error;
+
+    bool fail(const std::string& message) {
+        error = message;
+        return false;
+    }
+
+    // The same checks as the command line of Vicsek_Model
+    bool valid() {
+        if (params.nParticles <= 0 || params.width <= 0 || params.height <= 0 || params.interactionRadius <= 0) {
+            return fail("particle count, box size and radius must be positive");
+        }
+        if (params.topological < 0 || params.topological > maxTopological) {
+            return fail("topological takes k from 1 to " + std::to_string(maxTopological));
+        }
+        if (params.topological > 0 && params.engine != Engine::CellList) {
+            return fail("topological needs the cells engine");
+        }
+        if (const char* conflict = verletConflict(params)) {
+            return fail(conflict);
+        }
+        return true;
+    }
+
+    // Draw the initial state unless it exists
+    bool start() {
+        if (sim) return true;
+        if (!valid()) return false;
+        try {
+            sim.reset(new Simulation(params));
+        } catch (const std::bad_alloc&) {
+            return fail("out of memory");
+        }
+        params = sim->params;      // With the seed that was drawn
+        return true;
+    }
+
+    bool configurable() {
+        return !sim || fail("parameters can only be set before the first step");
+    }
+};
+
+
+extern "C" {
+
+int vicsek_api_version(void) {
+    return VICSEK_API_VERSION;
+}
+
+vicsek_sim* vicsek_create(void) {
+    vicsek_sim* sim = new (std::nothrow) vicsek_sim;
+    if (sim) {
+        sim->params.headless = true;
+    }
+    return sim;
+}
+
+void vicsek_destroy(vicsek_sim* sim) {
+    delete sim;
+}
+
+int vicsek_set(vicsek_sim* sim, const char* name, double value) {
+    sim->error.clear();
+    if (!sim->configurable()) return -1;
+    Params& params = sim->params;
+    if (std::strcmp(name, "n") == 0) {
+        params.nParticles = int(value);
+    } else if (std::strcmp(name, "width") == 0) {
+        params.width = value;
+    } else if (std::strcmp(name, "height") == 0) {
+        params.height = value;
+    } else if (std::strcmp(name, "noise") == 0) {
+        params.noise = value;
+    } else if (std::strcmp(name, "radius") == 0) {
+        params.interactionRadius = value;
+    } else if (std::strcmp(name, "velocity") == 0) {
+        params.velocity = value;
+    } else if (std::strcmp(name, "seed") == 0) {
+        params.seed = (unsigned int)value;
+        params.randomSeed = false;
+    } else if (std::strcmp(name, "topological") == 0) {
+        params.topological = int(value);
+    } else if (std::strcmp(name, "verlet") == 0) {
+        params.skin = value;
+    } else if (std::strcmp(name, "reorder") == 0) {
+        params.reorderEvery = int(value);
+    } else if (std::strcmp(name, "fast_math") == 0) {
+        params.fastMath = value != 0;
+    } else if (std::strcmp(name, "threads") == 0) {
+#ifdef _OPENMP
+        omp_set_num_threads(int(value));
+#endif
+    } else {
+        sim->fail(std::string("unknown parameter ") + name);
+        return -1;
+    }
+    return 0;
+}
+
+int vicsek_set_option(vicsek_sim* sim, const char* name, const char* value) {
+    sim->error.clear();
+    if (!sim->configurable()) return -1;
+    Params& params = sim->params;
+    if (std::strcmp(name, "engine") == 0) {
+        if (std::strcmp(value, "cells") == 0) {
+            params.engine = Engine::CellList;
+        } else if (std::strcmp(value, "quadtree") == 0) {
+            params.engine = Engine::Quadtree;
+        } else if (std::strcmp(value, "flat-quadtree") == 0) {
+            params.engine = Engine::FlatQuadtree;
+        } else if (std::strcmp(value, "brute-force") == 0) {
+            params.engine = Engine::BruteForce;
+        } else {
+            sim->fail(std::string("unknown engine ") + value);
+            return -1;
+        }
+    } else if (std::strcmp(name, "noise_dist") == 0) {
+        if (std::strcmp(value, "uniform") == 0) {
+            params.noiseDistribution = NoiseDistribution::Uniform;
+        } else if (std::strcmp(value, "gaussian") == 0) {
+            params.noiseDistribution = NoiseDistribution::Gaussian;
+        } else {
+            sim->fail(std::string("unknown noise distribution ") + value);
+            return -1;
+        }
+    } else {
+        sim->fail(std::string("unknown option ") + name);
+        return -1;
+    }
+    return 0;
+}
+
+int vicsek_start(vicsek_sim* sim) {
+    sim->error.clear();
+    return sim->start() ? 0 : -1;
+}
+
+int vicsek_step(vicsek_sim* sim, int64_t n) {
+    sim->error.clear();
+    if (!sim->start()) return -1;
+    for (int64_t s = 0; s < n; s++) {
+        sim->sim->step();
+    }
+    return 0;
+}
+
+int vicsek_count(vicsek_sim* sim) {
+    return sim->start() ? sim->params.nParticles : 0;
+}
+
+int64_t vicsek_iteration(vicsek_sim* sim) {
+    return sim->start() ? sim->sim->iteration : 0;
+}
+
+uint64_t vicsek_seed(vicsek_sim* sim) {
+    return sim->start() ? sim->params.seed : 0;
+}
+
+const float* vicsek_pos_x(vicsek_sim* sim) {
+    return sim->start() ? sim->sim->posX.data() : nullptr;
+}
+
+const float* vicsek_pos_y(vicsek_sim* sim) {
+    return sim->start() ? sim->sim->posY.data() : nullptr;
+}
+
+const float* vicsek_vel_x(vicsek_sim* sim) {
+    return sim->start() ? sim->sim->velX.data() : nullptr;
+}
+
+const float* vicsek_vel_y(vicsek_sim* sim) {
+    return sim->start() ? sim->sim->velY.data() : nullptr;
+}
+
+const float* vicsek_angles(vicsek_sim* sim) {
+    return sim->start() ? sim->sim->angles.data() : nullptr;
+}
+
+const int32_t* vicsek_ids(vicsek_sim* sim) {
+    static_assert(sizeof(int) == sizeof(int32_t), "ids are exposed as int32_t");
+    return sim->start() ? reinterpret_cast<const int32_t*>(sim->sim->ids.data()) : nullptr;
+}
+
+int vicsek_get_observables(vicsek_sim* sim, vicsek_observables* out) {
+    if (!sim->start()) return -1;
+    const Observables& obs = sim->sim->observables;
+    out->step = obs.step;
+    out->polar_order = obs.polarOrder;
+    out->mean_heading = obs.meanHeading;
+    out->mean_neighbors = obs.meanNeighbors;
+    return 0;
+}
+
+int vicsek_save(vicsek_sim* sim, const char* path) {
+    sim->error.clear();
+    if (!sim->start()) return -1;
+    if (!saveCheckpoint(*sim->sim, path)) {
+        sim->fail(std::string("could not write checkpoint ") + path);
+        return -1;
+    }
+    return 0;
+}
+
+// Replaces parameters and state, whether the simulation was started or not
+int vicsek_load(vicsek_sim* sim, const char* path) {
+    sim->error.clear();
+    Params params = sim->params;
+    if (!readCheckpointParams(path, params)) {
+        sim->fail(std::string("not a checkpoint file: ") + path);
+        return -1;
+    }
+    if (const char* conflict = verletConflict(params)) {
+        sim->fail(std::string(path) + ": " + conflict);
+        return -1;
+    }
+    std::unique_ptr<Simulation> loaded;
+    try {
+        loaded.reset(new Simulation(params));
+    } catch (const std::bad_alloc&) {
+        sim->fail("out of memory");
+        return -1;
+    }
+    if (!loadCheckpoint(path, *loaded)) {
+        sim->fail(std::string("checkpoint is truncated or does not match: ") + path);
+        return -1;
+    }
+    sim->params = params;
+    sim->sim = std::move(loaded);
+    return 0;
+}
+
+const char* vicsek_last_error(const vicsek_sim* sim) {
+    return sim->error.c_str();
+}
+
+}
@@ -0,0 +1,104 @@
+#ifndef VICSEK_H
+#define VICSEK_H
+
+#include <stdint.h>
+
+/*
+ * libvicsek: the 2D simulation of Vicsek_Model behind a C ABI, for driving
+ * it from other programs (Python ctypes, Julia ccall, C) without the SDL
+ * front end. Typical use:
+ *
+ *     vicsek_sim* sim = vicsek_create();
+ *     vicsek_set(sim, "n", 20000);
+ *     vicsek_set(sim, "seed", 1);
+ *     vicsek_set_option(sim, "engine", "cells");
+ *     vicsek_step(sim, 100);
+ *     const float* x = vicsek_pos_x(sim);      // n floats, in slot order
+ *     ...
+ *     vicsek_destroy(sim);
+ *
+ * Parameters can only be set before the first step or state access, which
+ * draws the initial state. The state pointers point into the simulation's
+ * own arrays, nothing is copied; they stay valid until the next call to
+ * vicsek_step or vicsek_destroy, so fetch them again after every step.
+ * Particles are stored by slot; slots only change order with the "reorder"
+ * parameter, vicsek_ids gives the particle id of each slot.
+ *
+ * Functions returning int give 0 on success and -1 on error, with the
+ * reason in vicsek_last_error.
+ */
+
+#if defined(_WIN32)
+#define VICSEK_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define VICSEK_API __attribute__((visibility("default")))
+#else
+#define VICSEK_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct vicsek_sim vicsek_sim;
+
+/* Scalar measurements after the last step, as in the --observe log */
+typedef struct vicsek_observables {
+    int64_t step;
+    double polar_order;             /* |sum v_i| / (N v0) */
+    double mean_heading;            /* Angle of sum v_i */
+    double mean_neighbors;          /* Other particles within the radius, on average */
+} vicsek_observables;
+
+/* Version of this interface, bumped on incompatible changes */
+#define VICSEK_API_VERSION 1
+VICSEK_API int vicsek_api_version(void);
+
+/* A simulation with the defaults of Vicsek_Model, or NULL without memory */
+VICSEK_API vicsek_sim* vicsek_create(void);
+VICSEK_API void vicsek_destroy(vicsek_sim* sim);
+
+/*
+ * Numeric parameters, named like the command-line flags: "n", "width",
+ * "height", "noise", "radius" (interaction radius), "velocity", "seed",
+ * "topological", "verlet" (skin), "reorder", "fast_math" (0 or 1) and
+ * "threads" (OpenMP threads, process wide).
+ */
+VICSEK_API int vicsek_set(vicsek_sim* sim, const char* name, double value);
+
+/*
+ * Named choices: "engine" = cells, quadtree, flat-quadtree, brute-force;
+ * "noise_dist" = uniform, gaussian.
+ */
+VICSEK_API int vicsek_set_option(vicsek_sim* sim, const char* name, const char* value);
+
+/* Advance n steps; draws the initial state first if needed */
+VICSEK_API int vicsek_step(vicsek_sim* sim, int64_t n);
+
+/* Draw the initial state now, e.g. to read it before stepping */
+VICSEK_API int vicsek_start(vicsek_sim* sim);
+
+/* State, starting the simulation if needed. NULL or 0 after an error. */
+VICSEK_API int vicsek_count(vicsek_sim* sim);
+VICSEK_API int64_t vicsek_iteration(vicsek_sim* sim);
+VICSEK_API uint64_t vicsek_seed(vicsek_sim* sim);
+VICSEK_API const float* vicsek_pos_x(vicsek_sim* sim);
+VICSEK_API const float* vicsek_pos_y(vicsek_sim* sim);
+VICSEK_API const float* vicsek_vel_x(vicsek_sim* sim);
+VICSEK_API const float* vicsek_vel_y(vicsek_sim* sim);
+VICSEK_API const float* vicsek_angles(vicsek_sim* sim);
+VICSEK_API const int32_t* vicsek_ids(vicsek_sim* sim);
+VICSEK_API int vicsek_get_observables(vicsek_sim* sim, vicsek_observables* out);
+
+/* Checkpoints in the Vicsek_Model format, for --restart or vicsek_load */
+VICSEK_API int vicsek_save(vicsek_sim* sim, const char* path);
+VICSEK_API int vicsek_load(vicsek_sim* sim, const char* path);
+
+/* Why the last call on sim failed, "" if it did not */
+VICSEK_API const char* vicsek_last_error(const vicsek_sim* sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
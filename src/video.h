@@ -0,0 +1,331 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Writes ARGB frames (as drawn by Rasterizer) to a movie from a background
+// thread. The format follows the path:
+//   *.y4m            YUV4MPEG2, 4:4:4, readable by ffmpeg and most players
+//   *.gif            animated GIF, 3-3-2 RGB palette, LZW written here
+//   anything with %  one binary PPM per frame, the path is a printf pattern
+//                    for the frame number, e.g. frames/vicsek_%05d.ppm, with
+//                    a single integer conversion (see framePattern)
+// submit() copies the frame into one of two buffers and returns; it only
+// waits when both are still queued, i.e. when encoding is the bottleneck.
+class VideoWriter {
+public:
+    enum class Format { Y4M, GIF, PPM };
+
+    ~VideoWriter() {
+        close();
+    }
+
+    bool open(const std::string& path_, int width_, int height_, int fps_) {
+        path = path_;
+        width = width_;
+        height = height_;
+        fps = fps_;
+        size_t dot = path.rfind('.');
+        std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+        if (path.find('%') != std::string::npos) {
+            if (!framePattern(path)) {
+                std::cerr << "A PPM frame pattern needs exactly one integer conversion such as %05d,"
+                          << " and %% for a literal %: " << path << "\n";
+                return false;
+            }
+            format = Format::PPM;
+        } else if (extension == ".y4m") {
+            format = Format::Y4M;
+        } else if (extension == ".gif") {
+            format = Format::GIF;
+        } else {
+            std::cerr << "Video export needs a .y4m or .gif file or a %d pattern for PPM frames: " << path << "\n";
+            return false;
+        }
+
+        if (format != Format::PPM) {
+            file = fopen(path.c_str(), "wb");
+            if (file == NULL) {
+                std::cerr << "Could not open video file " << path << "\n";
+                return false;
+            }
+            if (format == Format::Y4M) {
+                fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+            } else {
+                writeGifHeader();
+            }
+        }
+
+        frames = 0;
+        queued.clear();
+        stopping = false;
+        failed = false;
+        idle = {&buffers[0], &buffers[1]};
+        worker = std::thread(&VideoWriter::run, this);
+        running = true;
+        return true;
+    }
+
+    // Whether path is safe as the printf format of writePPM: one conversion
+    // of an int (flags, width and precision allowed, no * or length), and
+    // any other % doubled
+    static bool framePattern(const std::string& path) {
+        int conversions = 0;
+        for (size_t i = 0; i < path.size(); i++) {
+            if (path[i] != '%') continue;
+            if (++i < path.size() && path[i] == '%') continue;
+            while (i < path.size() && strchr("-+ #0", path[i])) i++;
+            while (i < path.size() && path[i] >= '0' && path[i] <= '9') i++;
+            if (i < path.size() && path[i] == '.') {
+                i++;
+                while (i < path.size() && path[i] >= '0' && path[i] <= '9') i++;
+            }
+            if (i >= path.size() || !strchr("diouxX", path[i])) return false;
+            conversions++;
+        }
+        return conversions == 1;
+    }
+
+    bool isOpen() const {
+        return running;
+    }
+
+    void submit(const std::vector<uint32_t>& pixels) {
+        std::vector<uint32_t>* frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]{ return !idle.empty(); });
+            frame = idle.back();
+            idle.pop_back();
+        }
+        frame->assign(pixels.begin(), pixels.end());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(frame);
+        }
+        changed.notify_all();
+    }
+
+    // Encode the queued frames and finish the file
+    void close() {
+        if (!running) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        worker.join();
+        running = false;
+
+        if (file != NULL) {
+            if (format == Format::GIF) fputc(0x3B, file);      // Trailer
+            if (fclose(file) != 0) failed = true;
+            file = NULL;
+        }
+        if (failed) {
+            std::cerr << "Error while writing video " << path << "\n";
+        }
+    }
+
+private:
+    std::string path;
+    Format format = Format::Y4M;
+    int width = 0, height = 0, fps = 30;
+    FILE* file = NULL;
+    bool running = false;
+    long frames = 0;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<uint32_t> buffers[2];
+    std::vector<std::vector<uint32_t>*> idle, queued;
+    bool stopping = false;
+    bool failed = false;
+
+    // Only used by the worker
+    std::vector<uint8_t> plane;
+    std::vector<int16_t> dictionary;    // LZW hash table, -1 = empty slot
+    std::vector<int32_t> dictionaryKey;
+    std::vector<uint8_t> packed;
+    uint32_t bitBuffer = 0;
+    int bitCount = 0;
+
+    void run() {
+        while (true) {
+            std::vector<uint32_t>* frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]{ return stopping || !queued.empty(); });
+                if (queued.empty()) return;
+                frame = queued.front();
+                queued.erase(queued.begin());
+            }
+            if (format == Format::Y4M) writeY4M(*frame);
+            else if (format == Format::GIF) writeGifFrame(*frame);
+            else writePPM(*frame);
+            frames++;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.push_back(frame);
+            }
+            changed.notify_all();
+        }
+    }
+
+    // BT.601 studio range, full resolution chroma
+    void writeY4M(const std::vector<uint32_t>& pixels) {
+        size_t n = pixels.size();
+        plane.resize(3 * n);
+        for (size_t i = 0; i < n; i++) {
+            int r = (pixels[i] >> 16) & 0xFF, g = (pixels[i] >> 8) & 0xFF, b = pixels[i] & 0xFF;
+            plane[i] = uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            plane[n + i] = uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            plane[2 * n + i] = uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+        if (fputs("FRAME\n", file) < 0 || fwrite(plane.data(), 1, plane.size(), file) != plane.size()) {
+            failed = true;
+        }
+    }
+
+    void writePPM(const std::vector<uint32_t>& pixels) {
+        char name[4096];
+        snprintf(name, sizeof(name), path.c_str(), int(frames));
+        FILE* out = fopen(name, "wb");
+        if (out == NULL) {
+            failed = true;
+            return;
+        }
+        plane.resize(3 * pixels.size());
+        for (size_t i = 0; i < pixels.size(); i++) {
+            plane[3 * i] = (pixels[i] >> 16) & 0xFF;
+            plane[3 * i + 1] = (pixels[i] >> 8) & 0xFF;
+            plane[3 * i + 2] = pixels[i] & 0xFF;
+        }
+        fprintf(out, "P6\n%d %d\n255\n", width, height);
+        if (fwrite(plane.data(), 1, plane.size(), out) != plane.size()) failed = true;
+        if (fclose(out) != 0) failed = true;
+    }
+
+    void put16(int value) {
+        fputc(value & 0xFF, file);
+        fputc((value >> 8) & 0xFF, file);
+    }
+
+    // Screen descriptor, the fixed 3-3-2 palette and an endless loop
+    void writeGifHeader() {
+        fwrite("GIF89a", 1, 6, file);
+        put16(width);
+        put16(height);
+        fputc(0xF7, file);                  // Global colour table of 256 entries
+        fputc(0, file);                     // Background colour
+        fputc(0, file);                     // Square pixels
+        for (int c = 0; c < 256; c++) {
+            fputc(((c >> 5) & 7) * 255 / 7, file);
+            fputc(((c >> 2) & 7) * 255 / 7, file);
+            fputc((c & 3) * 255 / 3, file);
+        }
+        static const uint8_t loop[] = {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E',
+                                       '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00};
+        fwrite(loop, 1, sizeof(loop), file);
+    }
+
+    void writeGifFrame(const std::vector<uint32_t>& pixels) {
+        // Graphic control extension with the frame delay in 1/100 s
+        static const uint8_t control[] = {0x21, 0xF9, 0x04, 0x00};
+        fwrite(control, 1, sizeof(control), file);
+        put16(std::max(1, 100 / std::max(1, fps)));
+        fputc(0, file);
+        fputc(0, file);
+
+        // Image descriptor covering the whole screen, no local palette
+        fputc(0x2C, file);
+        put16(0);
+        put16(0);
+        put16(width);
+        put16(height);
+        fputc(0, file);
+
+        plane.resize(pixels.size());
+        for (size_t i = 0; i < pixels.size(); i++) {
+            uint32_t p = pixels[i];
+            plane[i] = uint8_t((p >> 16 & 0xE0) | (p >> 11 & 0x1C) | (p >> 6 & 0x03));
+        }
+        fputc(8, file);                     // LZW minimum code size
+        packed.clear();
+        compressLZW(plane);
+        for (size_t k = 0; k < packed.size(); k += 255) {
+            size_t block = std::min<size_t>(255, packed.size() - k);
+            fputc(int(block), file);
+            fwrite(packed.data() + k, 1, block, file);
+        }
+        fputc(0, file);                     // Block terminator
+        if (ferror(file)) failed = true;
+    }
+
+    // Variable-width codes from 9 to 12 bits, packed LSB first. The string
+    // table is a hash of (prefix code, next byte) and is reset with a clear
+    // code when it is full, like giflib does.
+    void compressLZW(const std::vector<uint8_t>& data) {
+        const int clearCode = 256, endCode = 257, maxCode = 4095;
+        const int tableSize = 5003;         // Prime, a bit over the 4096 codes
+        dictionary.assign(tableSize, -1);
+        dictionaryKey.resize(tableSize);
+        int codeSize = 9;
+        int nextCode = endCode + 1;
+        bitBuffer = 0;
+        bitCount = 0;
+
+        auto emit = [&](int code) {
+            bitBuffer |= uint32_t(code) << bitCount;
+            bitCount += codeSize;
+            while (bitCount >= 8) {
+                packed.push_back(uint8_t(bitBuffer & 0xFF));
+                bitBuffer >>= 8;
+                bitCount -= 8;
+            }
+            if (nextCode >= (1 << codeSize) && codeSize < 12) codeSize++;
+        };
+
+        emit(clearCode);
+        if (data.empty()) {
+            emit(endCode);
+            return;
+        }
+        int current = data[0];
+        for (size_t i = 1; i < data.size(); i++) {
+            int key = current << 8 | data[i];
+            int slot = key % tableSize;
+            while (dictionary[slot] >= 0 && dictionaryKey[slot] != key) {
+                slot = slot + 1 == tableSize ? 0 : slot + 1;
+            }
+            if (dictionary[slot] >= 0) {
+                current = dictionary[slot];
+                continue;
+            }
+            emit(current);
+            if (nextCode >= maxCode) {
+                emit(clearCode);
+                dictionary.assign(tableSize, -1);
+                nextCode = endCode + 1;
+                codeSize = 9;
+            } else {
+                dictionary[slot] = int16_t(nextCode++);
+                dictionaryKey[slot] = key;
+            }
+            current = data[i];
+        }
+        emit(current);
+        emit(endCode);
+        if (bitCount > 0) packed.push_back(uint8_t(bitBuffer & 0xFF));
+    }
+};